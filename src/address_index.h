@@ -0,0 +1,80 @@
+#ifndef ADDRESS_INDEX_H
+#define ADDRESS_INDEX_H
+
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+/*
+ * map from MAC (or IP) addresses to node indices
+ * open addressing with linear probing over 8 byte slots, kept at most half full,
+ * so that there is no heap allocation per node
+ */
+class AddressIndex {
+private:
+    static uint32_t constexpr EMPTY = ~uint32_t(0);
+    struct Slot {
+        uint32_t address;
+        uint32_t index;
+    };
+    std::vector<Slot> slots;
+    size_t count = 0;
+
+    size_t slot_of(uint32_t address) const
+    {
+        return ((address * 0x9E3779B97F4A7C15ull) >> 32) & (slots.size() - 1);
+    }
+    void rehash(size_t nr_slots)
+    {
+        std::vector<Slot> old(nr_slots, Slot { 0, EMPTY });
+        old.swap(slots);
+        count = 0;
+        for (Slot const& s : old)
+            if (s.index != EMPTY)
+                insert(s.address, s.index);
+    }
+
+public:
+    static size_t constexpr MAX_INDEX = EMPTY - 1;
+
+    size_t size() const { return count; }
+
+    void reserve(size_t n)
+    {
+        size_t nr_slots = (slots.empty() ? 16 : slots.size());
+        while (nr_slots < 2 * n)
+            nr_slots *= 2;
+        if (nr_slots > slots.size())
+            rehash(nr_slots);
+    }
+
+    std::optional<size_t> find(uint32_t address) const
+    {
+        if (slots.empty())
+            return std::nullopt;
+        for (size_t i = slot_of(address);; i = (i + 1) & (slots.size() - 1)) {
+            if (slots[i].index == EMPTY)
+                return std::nullopt;
+            if (slots[i].address == address)
+                return slots[i].index;
+        }
+    }
+
+    /*
+     * returns false (and leaves the map as is) if `address` is already present
+     */
+    bool insert(uint32_t address, size_t index)
+    {
+        reserve(count + 1);
+        size_t i = slot_of(address);
+        for (; slots[i].index != EMPTY; i = (i + 1) & (slots.size() - 1))
+            if (slots[i].address == address)
+                return false;
+        slots[i] = { address, static_cast<uint32_t>(index) };
+        count++;
+        return true;
+    }
+};
+
+#endif // ADDRESS_INDEX_H
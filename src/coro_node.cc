@@ -0,0 +1,58 @@
+#include "coro_node.h"
+#include "simulation.h"
+
+bool CoroNode::ready(Wait const& w) const
+{
+    if (w.recv && inbox_head < inbox.size())
+        return true;
+    return w.deadline.has_value() && Clock::now() >= w.deadline.value();
+}
+
+/*
+ * of the packet `run` handles until it waits again, which may have been received in
+ * an earlier callback, as what it sends meanwhile is caused by that packet
+ */
+static thread_local std::optional<Simulation::CurrentTrace> taken_trace;
+
+std::optional<CoroNode::Packet> CoroNode::take(Wait const& w)
+{
+    Simulation::current_trace = nullptr;
+    if (!w.recv || inbox_head == inbox.size())
+        return std::nullopt;
+    Packet p = std::move(inbox[inbox_head++]);
+    if (p.trace != nullptr) {
+        taken_trace.emplace(Simulation::CurrentTrace { p.trace->segment_id, p.trace->mac, p.trace->distance, &p.trace->prev, p.trace });
+        Simulation::current_trace = &taken_trace.value();
+    }
+    if (inbox_head == inbox.size()) {
+        inbox.clear();
+        inbox_head = 0;
+    }
+    return p;
+}
+
+void CoroNode::resume_if_ready()
+{
+    // which `take` changes
+    Simulation::CurrentTrace* caller_trace = Simulation::current_trace;
+    if (!main.has_value()) {
+        main.emplace(run());
+        main->handle.resume();
+    }
+    while (waiting.has_value() && ready(waiting.value())) {
+        waiting.reset();
+        main->handle.resume();
+    }
+    Simulation::current_trace = caller_trace;
+}
+
+void CoroNode::receive_packet(MACAddress src_mac, std::vector<uint8_t> packet, size_t distance)
+{
+    inbox.push_back({ src_mac, std::move(packet), distance, Simulation::current_hop() });
+    resume_if_ready();
+}
+
+void CoroNode::do_periodic()
+{
+    resume_if_ready();
+}
@@ -0,0 +1,139 @@
+#ifndef CORO_NODE_H
+#define CORO_NODE_H
+
+#include "node.h"
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+struct SegmentTrace;
+
+/*
+ * node whose protocol is written as a single coroutine, `run`, instead of
+ * being spread across `receive_packet` and `do_periodic`, e.g.
+ *
+ *      CoroNode::Task run() override
+ *      {
+ *          for (;;) {
+ *              auto p = co_await any_of(recv(), sleep_until(next_hello));
+ *              ...
+ *          }
+ *      }
+ *
+ * `run` is started on the first callback, and resumed from the node's callbacks
+ * (so, like them, never concurrently) once what it awaits is available:
+ *  - `recv()` resumes with the next packet received
+ *  - `sleep_for(t)`/`sleep_until(t)` resume once `t` has passed, as checked by
+ *    `do_periodic`, at its granularity
+ *  - `any_of(...)` resumes on the first of its arguments, with the packet
+ *    received if that is what it resumed on
+ * coroutine nodes own no thread, in compact mode they are all run by the worker pool
+ */
+class CoroNode : public Node {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Packet {
+        MACAddress src_mac;
+        std::vector<uint8_t> packet;
+        size_t distance;
+        // of the segment copy the packet carries at this node, if any, traced again while `run` handles it
+        std::shared_ptr<SegmentTrace const> trace;
+    };
+
+    class Task {
+    public:
+        struct promise_type {
+            Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            void return_void() { }
+            // propagates out of the callback that resumed `run`
+            void unhandled_exception() { throw; }
+        };
+
+    private:
+        friend class CoroNode;
+        std::coroutine_handle<promise_type> handle;
+        explicit Task(std::coroutine_handle<promise_type> handle)
+            : handle(handle) { }
+
+    public:
+        Task(Task&& t)
+            : handle(std::exchange(t.handle, nullptr)) { }
+        Task& operator=(Task&& t)
+        {
+            std::swap(handle, t.handle);
+            return *this;
+        }
+        ~Task()
+        {
+            if (handle)
+                handle.destroy();
+        }
+    };
+
+    class Wait {
+    protected:
+        friend class CoroNode;
+        CoroNode* node;
+        bool recv;
+        std::optional<Clock::time_point> deadline;
+        Wait(CoroNode* node, bool recv, std::optional<Clock::time_point> deadline)
+            : node(node), recv(recv), deadline(deadline) { }
+
+    public:
+        bool await_ready() const { return node->ready(*this); }
+        void await_suspend(std::coroutine_handle<>) { node->waiting = *this; }
+        std::optional<Packet> await_resume() { return node->take(*this); }
+    };
+    struct RecvWait : Wait {
+        using Wait::Wait;
+        Packet await_resume() { return std::move(*node->take(*this)); }
+    };
+    struct SleepWait : Wait {
+        using Wait::Wait;
+        void await_resume() { node->take(*this); }
+    };
+
+private:
+    std::optional<Task> main;
+    std::optional<Wait> waiting;
+    // packets received and not taken yet are [inbox_head, end)
+    std::vector<Packet> inbox;
+    size_t inbox_head = 0;
+
+    bool ready(Wait const& w) const;
+    std::optional<Packet> take(Wait const& w);
+    void resume_if_ready();
+
+public:
+    CoroNode(Simulation* simul, MACAddress mac, IPAddress ip)
+        : Node(simul, mac, ip) { }
+
+    void receive_packet(MACAddress src_mac, std::vector<uint8_t> packet, size_t distance) final;
+    void do_periodic() final;
+
+protected:
+    virtual Task run() = 0;
+
+    RecvWait recv() { return RecvWait(this, true, std::nullopt); }
+    SleepWait sleep_until(Clock::time_point t) { return SleepWait(this, false, t); }
+    SleepWait sleep_for(Clock::duration t) { return sleep_until(Clock::now() + t); }
+    template <class... W>
+    Wait any_of(W const&... ws)
+    {
+        std::optional<Clock::time_point> deadline;
+        for (auto const& d : { ws.deadline... })
+            if (d.has_value())
+                deadline = std::min(deadline.value_or(d.value()), d.value());
+        return Wait(this, (ws.recv || ...), deadline);
+    }
+};
+
+#endif // CORO_NODE_H
@@ -0,0 +1,98 @@
+#include "event_trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+static size_t constexpr EVENTS_PER_BUFFER = 4096;
+
+EventTracer::Sink::~Sink()
+{
+    std::fclose(f);
+}
+void EventTracer::Sink::write(TraceEvent const* events, size_t n)
+{
+    std::lock_guard<std::mutex> lg(mt);
+    std::fwrite(events, sizeof(TraceEvent), n, f);
+}
+
+EventTracer::EventTracer(std::string const& path, bool record_timers)
+    : epoch(std::chrono::steady_clock::now()), phase(0), record_timers(record_timers)
+{
+    std::FILE* f = std::fopen(path.c_str(), "wb");
+    if (f == nullptr)
+        throw std::runtime_error("Unable to open file '" + path + "' for writing");
+    sink = std::make_shared<Sink>();
+    sink->f = f;
+
+    TraceFileHeader h;
+    std::copy(std::begin(TRACE_MAGIC), std::end(TRACE_MAGIC), h.magic);
+    h.version = TRACE_VERSION;
+    h.event_size = sizeof(TraceEvent);
+    std::fwrite(&h, sizeof(h), 1, f);
+}
+
+namespace {
+struct ThreadBuffer {
+    std::shared_ptr<EventTracer::Sink> sink;
+    std::array<TraceEvent, EVENTS_PER_BUFFER> events;
+    size_t n = 0;
+
+    void flush()
+    {
+        if (n > 0)
+            sink->write(events.data(), n);
+        n = 0;
+    }
+    ~ThreadBuffer()
+    {
+        if (sink != nullptr)
+            flush();
+    }
+};
+}
+
+void EventTracer::record(EventType type, MACAddress node, MACAddress peer, uint32_t bytes, PacketClass cls, uint64_t segment_id, uint64_t packet_id)
+{
+    /*
+     * allocated on the first event of the thread, so that threads (and runs)
+     * not tracing do not pay for a buffer
+     */
+    static thread_local std::unique_ptr<ThreadBuffer> tbuf;
+    if (tbuf == nullptr)
+        tbuf = std::make_unique<ThreadBuffer>();
+    ThreadBuffer& buf = *tbuf;
+    if (buf.sink != sink) {
+        if (buf.sink != nullptr)
+            buf.flush();
+        buf.sink = sink;
+    }
+
+    TraceEvent& e = buf.events[buf.n++];
+    e.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    e.packet_id = packet_id;
+    e.segment_id = segment_id;
+    e.node = node;
+    e.peer = peer;
+    e.bytes = bytes;
+    e.phase = phase.load(std::memory_order_relaxed);
+    e.type = type;
+    e.cls = cls;
+    std::fill(std::begin(e.reserved), std::end(e.reserved), 0);
+
+    if (buf.n == EVENTS_PER_BUFFER)
+        buf.flush();
+}
+
+uint64_t EventTracer::new_packet_id()
+{
+    /*
+     * top 24 bits identify the thread, so that no synchronisation is needed
+     */
+    static std::atomic<uint64_t> nr_threads = 0;
+    static thread_local uint64_t prefix = nr_threads++ << 40;
+    static thread_local uint64_t next = 0;
+    return prefix | next++;
+}
@@ -0,0 +1,153 @@
+#ifndef EVENT_TRACE_H
+#define EVENT_TRACE_H
+
+#include "node.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/*
+ * binary trace format: a `TraceFileHeader` followed by `TraceEvent`s
+ * events are grouped in per-thread chunks and hence are not ordered by time
+ */
+static char constexpr TRACE_MAGIC[8] = { 'L', '2', 'S', 'T', 'R', 'A', 'C', 'E' };
+static uint32_t constexpr TRACE_VERSION = 3;
+
+struct TraceFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t event_size;
+};
+
+enum class EventType : uint8_t {
+    SEND,
+    RECEIVE,
+    DROP,
+    UP,
+    DOWN,
+    TIMER,
+    DELIVER,
+    PHASE,
+    ADD_NODE,
+    // `node` and `peer` are the ends of the link, `bytes` its distance
+    LINK_UP,
+    LINK_DOWN,
+    COST,
+    ADD_EDGE,
+};
+
+static uint64_t constexpr TRACE_NONE = ~uint64_t(0);
+
+struct TraceEvent {
+    // since the start of the run
+    uint64_t time_ns;
+    // shared by the SEND and RECEIVE (or DROP) of a packet, TRACE_NONE for other events
+    uint64_t packet_id;
+    // simulator-side id of the segment carried, TRACE_NONE if none
+    uint64_t segment_id;
+    MACAddress node;
+    // other end of a SEND/RECEIVE/DROP
+    MACAddress peer;
+    uint32_t bytes;
+    uint32_t phase;
+    EventType type;
+    PacketClass cls;
+    // zeroed
+    uint8_t reserved[6];
+};
+static_assert(sizeof(TraceEvent) == 48, "trace events are written as is");
+
+inline char const* packet_class_name(PacketClass cls)
+{
+    switch (cls) {
+    case PacketClass::UNTAGGED:
+        return "untagged";
+    case PacketClass::DATA:
+        return "data";
+    case PacketClass::CONTROL:
+        return "control";
+    case PacketClass::HELLO:
+        return "hello";
+    case PacketClass::LSA:
+        return "lsa";
+    case PacketClass::DISTANCE_VECTOR:
+        return "distance-vector";
+    case PacketClass::ACK:
+        return "ack";
+    }
+    return "unknown";
+}
+
+inline char const* event_type_name(EventType type)
+{
+    switch (type) {
+    case EventType::SEND:
+        return "send";
+    case EventType::RECEIVE:
+        return "receive";
+    case EventType::DROP:
+        return "drop";
+    case EventType::UP:
+        return "up";
+    case EventType::DOWN:
+        return "down";
+    case EventType::TIMER:
+        return "timer";
+    case EventType::DELIVER:
+        return "deliver";
+    case EventType::PHASE:
+        return "phase";
+    case EventType::LINK_UP:
+        return "link-up";
+    case EventType::LINK_DOWN:
+        return "link-down";
+    case EventType::COST:
+        return "cost";
+    case EventType::ADD_NODE:
+        return "add-node";
+    case EventType::ADD_EDGE:
+        return "add-edge";
+    }
+    return "unknown";
+}
+
+class EventTracer {
+public:
+    struct Sink {
+        std::mutex mt;
+        std::FILE* f;
+        ~Sink();
+        void write(TraceEvent const* events, size_t n);
+    };
+
+private:
+    std::shared_ptr<Sink> sink;
+    std::chrono::steady_clock::time_point const epoch;
+
+public:
+    /*
+     * throws std::runtime_error if `path` cannot be opened for writing
+     */
+    EventTracer(std::string const& path, bool record_timers = false);
+
+    std::atomic<uint32_t> phase;
+    /*
+     * whether every `do_periodic` call is recorded as a TIMER event, off by default
+     * as they would make up most of the trace (one per node every 100us)
+     */
+    bool const record_timers;
+
+    /*
+     * lock-free unless the calling thread's buffer is full,
+     * buffers are written out when full and when their thread exits
+     */
+    void record(EventType type, MACAddress node, MACAddress peer = 0, uint32_t bytes = 0, PacketClass cls = PacketClass::UNTAGGED, uint64_t segment_id = TRACE_NONE, uint64_t packet_id = TRACE_NONE);
+    static uint64_t new_packet_id();
+};
+
+#endif // EVENT_TRACE_H
@@ -0,0 +1,53 @@
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+/*
+ * up/down state of every node, indexed by node index
+ * reads and updates may race with each other, `resize` may not
+ */
+class LivenessSet {
+private:
+    size_t nr_words;
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+
+public:
+    explicit LivenessSet(size_t n)
+        : nr_words(0)
+    {
+        resize(n);
+    }
+
+    /*
+     * new nodes start off up
+     */
+    void resize(size_t n)
+    {
+        size_t w = (n + 63) / 64;
+        if (w <= nr_words)
+            return;
+        std::unique_ptr<std::atomic<uint64_t>[]> nw(new std::atomic<uint64_t>[w]);
+        for (size_t i = 0; i < w; ++i)
+            nw[i] = (i < nr_words ? words[i].load() : ~uint64_t(0));
+        words = std::move(nw);
+        nr_words = w;
+    }
+
+    bool test(size_t i) const
+    {
+        return (words[i / 64].load(std::memory_order_acquire) >> (i % 64)) & 1;
+    }
+    void set(size_t i, bool up)
+    {
+        uint64_t bit = uint64_t(1) << (i % 64);
+        if (up)
+            words[i / 64].fetch_or(bit, std::memory_order_acq_rel);
+        else
+            words[i / 64].fetch_and(~bit, std::memory_order_acq_rel);
+    }
+};
+
+#endif // LIVENESS_H
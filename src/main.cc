@@ -1,13 +1,35 @@
+#include "metrics.h"
 #include "simulation.h"
+#include "sweep.h"
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <thread>
 
 extern "C" bool log_enabled;
 extern "C" bool grading_view;
 extern "C" char const* logfile_prefix;
 extern "C" char const* args[3];
 extern "C" size_t delay_ms;
+extern "C" char const* segment_trace_file;
+extern "C" char const* event_trace_file;
+extern "C" bool trace_timers;
+extern "C" bool profile_enabled;
+extern "C" char const* save_snapshot_file;
+extern "C" size_t snapshot_phase;
+extern "C" char const* restore_file;
+extern "C" char const* sweep_file;
+extern "C" size_t nr_jobs;
+extern "C" size_t queue_capacity;
+extern "C" char const* queue_policy;
+extern "C" char const* metrics_target;
+extern "C" size_t metrics_interval_ms;
+extern "C" bool compact;
+extern "C" size_t nr_workers;
 
 extern "C" void parse(int ac, char** av);
 
@@ -18,10 +40,31 @@ int main(int ac, char** av)
     std::map<std::string, Simulation::NT> m = {
         { "naive", Simulation::NT::NAIVE },
         { "blaster", Simulation::NT::BLASTER },
+        { "blaster-coro", Simulation::NT::BLASTER_CORO },
         { "rp", Simulation::NT::RP },
     };
+    if (sweep_file != nullptr) {
+        std::ifstream manifest(sweep_file);
+        if (!manifest.is_open()) {
+            std::cerr << "Unable to open file '" << sweep_file << "' for reading\n";
+            return 1;
+        }
+        if (nr_jobs == 0)
+            nr_jobs = std::max(std::thread::hardware_concurrency(), 1u);
+        run_sweep(parse_manifest(manifest, m), nr_jobs, std::cout);
+        return 0;
+    }
     if (m.count(args[0]) == 0) {
-        std::cerr << "Bad node type '" << args[0] << "', should be one of 'naive', 'blaster', or 'rp'\n";
+        std::cerr << "Bad node type '" << args[0] << "', should be one of 'naive', 'blaster', 'blaster-coro', or 'rp'\n";
+        return 1;
+    }
+    std::map<std::string, QueuePolicy> policies = {
+        { "tail-drop", QueuePolicy::TAIL_DROP },
+        { "red", QueuePolicy::RED },
+        { "backpressure", QueuePolicy::BACKPRESSURE },
+    };
+    if (policies.count(queue_policy) == 0) {
+        std::cerr << "Bad queue policy '" << queue_policy << "', should be one of 'tail-drop', 'red', or 'backpressure'\n";
         return 1;
     }
 
@@ -36,6 +79,64 @@ int main(int ac, char** av)
         return 1;
     }
 
-    Simulation s(m[args[0]], !!log_enabled, logfile_prefix, net_spec_file, delay_ms, !!grading_view);
-    s.run(msg_file);
+    std::ofstream segment_trace;
+    if (segment_trace_file != nullptr) {
+        segment_trace.open(segment_trace_file);
+        if (!segment_trace.is_open()) {
+            std::cerr << "Unable to open file '" << segment_trace_file << "' for writing\n";
+            return 1;
+        }
+    }
+
+    std::ofstream snapshot_out;
+    if (save_snapshot_file != nullptr) {
+        snapshot_out.open(save_snapshot_file, std::ios::binary);
+        if (!snapshot_out.is_open()) {
+            std::cerr << "Unable to open file '" << save_snapshot_file << "' for writing\n";
+            return 1;
+        }
+    }
+    std::ifstream snapshot_in;
+    if (restore_file != nullptr) {
+        snapshot_in.open(restore_file, std::ios::binary);
+        if (!snapshot_in.is_open()) {
+            std::cerr << "Unable to open file '" << restore_file << "' for reading\n";
+            return 1;
+        }
+    }
+
+    std::unique_ptr<EventTracer> tracer;
+    if (event_trace_file != nullptr) {
+        try {
+            tracer = std::make_unique<EventTracer>(event_trace_file, !!trace_timers);
+        } catch (std::runtime_error const& e) {
+            std::cerr << e.what() << '\n';
+            return 1;
+        }
+    }
+
+    std::unique_ptr<Profiler> profiler;
+    if (profile_enabled)
+        profiler = std::make_unique<Profiler>();
+
+    if (compact && nr_workers == 0)
+        nr_workers = std::max(std::thread::hardware_concurrency(), 1u);
+
+    auto s = Simulation::create(m[args[0]], !!log_enabled, logfile_prefix, NetSpec::parse(net_spec_file), delay_ms, !!grading_view, segment_trace.is_open() ? &segment_trace : nullptr, tracer.get(), profiler.get(), compact ? nr_workers : 0);
+    s->set_queue_limit({ queue_capacity, policies[queue_policy] });
+    // sampling the simulation, so destroyed first
+    std::unique_ptr<MetricsExporter> metrics;
+    if (metrics_target != nullptr) {
+        try {
+            metrics = std::make_unique<MetricsExporter>(*s, metrics_target, std::chrono::milliseconds(metrics_interval_ms));
+        } catch (std::runtime_error const& e) {
+            std::cerr << e.what() << '\n';
+            return 1;
+        }
+    }
+    if (snapshot_in.is_open())
+        s->restore(snapshot_in);
+    if (snapshot_out.is_open())
+        s->save_snapshot_after(snapshot_phase, &snapshot_out);
+    s->run(msg_file);
 }
@@ -0,0 +1,221 @@
+#include "metrics.h"
+#include "event_trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __linux__
+    #include <sys/resource.h>
+    #include <sys/syscall.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0
+#endif
+
+static char const SOCKET_PREFIX[] = "unix:";
+
+Simulation::Metrics Simulation::metrics() const
+{
+    Metrics m;
+    m.nr_phases_completed = phase;
+    m.packets_transmitted = packets_transmitted;
+    m.packets_distance = packets_distance;
+    m.packets_bytes = packets_bytes;
+    m.total_packets_transmitted = total_packets_transmitted;
+    m.total_packets_distance = total_packets_distance;
+    m.total_packets_bytes = total_packets_bytes;
+    for (size_t i = 0; i < NR_PACKET_CLASSES; ++i) {
+        m.class_packets[i] = class_counters[i].packets;
+        m.class_bytes[i] = class_counters[i].bytes;
+    }
+    m.packets_dropped = packets_dropped;
+    m.packets_dropped_at_queues = packets_dropped_at_queues;
+    m.packets_dropped_unreceived = packets_dropped_unreceived;
+    m.packets_refused = packets_refused;
+    m.packets_in_flight = packets_in_flight;
+    m.segment_packets_in_flight = segment_packets_in_flight;
+    m.nr_segments_delivered = nr_segments_delivered;
+    m.nr_segments_expected = nr_segments_expected;
+    m.nr_routing_loops = nr_routing_loops;
+    return m;
+}
+
+MetricsExporter::MetricsExporter(Simulation const& simul, std::string const& target, std::chrono::milliseconds interval)
+    : simul(simul), interval(interval), started_at(Clock::now()), listen_fd(-1), file_size(0),
+      last_sampled_at(started_at), last_total_packets_transmitted(0)
+{
+    if (target.rfind(SOCKET_PREFIX, 0) == 0) {
+        path = target.substr(sizeof(SOCKET_PREFIX) - 1);
+        sockaddr_un addr {};
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("Unable to listen on socket '" + path + "': Bad path");
+        std::copy(path.begin(), path.end(), addr.sun_path);
+        // left behind by an earlier run
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+            std::string err = std::strerror(errno);
+            if (listen_fd >= 0)
+                close(listen_fd);
+            throw std::runtime_error("Unable to listen on socket '" + path + "': " + err);
+        }
+    } else {
+        path = target;
+        file.open(path, std::ios::app);
+        if (!file.is_open())
+            throw std::runtime_error("Unable to open file '" + path + "' for writing");
+        file.seekp(0, std::ios::end);
+        file_size = file.tellp();
+    }
+
+    if (pipe(wake_fds) != 0) {
+        if (listen_fd >= 0)
+            close(listen_fd);
+        throw std::runtime_error("Unable to create pipe: " + std::string(std::strerror(errno)));
+    }
+    sampler = std::thread(&MetricsExporter::sample_loop, this);
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    char c = 0;
+    while (write(wake_fds[1], &c, 1) < 0 && errno == EINTR)
+        ;
+    sampler.join();
+    close(wake_fds[0]);
+    close(wake_fds[1]);
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(path.c_str());
+    }
+}
+
+void MetricsExporter::sample_loop()
+{
+#ifdef __linux__
+    // niceness is per thread on Linux
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+    std::string sample;
+    Clock::time_point next_sample = Clock::now();
+    while (true) {
+        Clock::time_point now = Clock::now();
+        if (now >= next_sample) {
+            sample = take_sample(now);
+            if (file.is_open())
+                append(sample);
+            next_sample = std::max(next_sample + interval, now);
+        }
+
+        pollfd fds[2] = { { wake_fds[0], POLLIN, 0 }, { listen_fd, POLLIN, 0 } };
+        auto timeout = std::chrono::ceil<std::chrono::milliseconds>(next_sample - Clock::now()).count();
+        if (poll(fds, (listen_fd >= 0 ? 2 : 1), std::max<int>(timeout, 0)) < 0)
+            continue;
+        if (fds[0].revents != 0)
+            break;
+        if ((fds[1].revents & POLLIN) != 0)
+            serve(sample);
+    }
+    // what the last phase ended with
+    if (file.is_open())
+        append(take_sample(Clock::now()));
+}
+
+std::string MetricsExporter::take_sample(Clock::time_point now)
+{
+    Simulation::Metrics m = simul.metrics();
+    // counters are reset at the start of every phase
+    size_t transmitted = m.total_packets_transmitted - (m.total_packets_transmitted >= last_total_packets_transmitted ? last_total_packets_transmitted : 0);
+    double elapsed = std::chrono::duration<double>(now - last_sampled_at).count();
+    last_sampled_at = now;
+    last_total_packets_transmitted = m.total_packets_transmitted;
+    return render(m, (elapsed > 0 ? transmitted / elapsed : 0), now);
+}
+
+std::string MetricsExporter::render(Simulation::Metrics const& m, double packets_per_second, Clock::time_point now) const
+{
+    std::ostringstream ss;
+    auto header = [&ss](char const* name, char const* type, char const* help) {
+        ss << "# HELP " << name << ' ' << help << '\n'
+           << "# TYPE " << name << ' ' << type << '\n';
+    };
+    auto metric = [&](char const* name, char const* type, char const* help, auto value) {
+        header(name, type, help);
+        ss << name << ' ' << value << '\n';
+    };
+
+    metric("l2sim_uptime_seconds", "gauge", "Time since the exporter started", std::chrono::duration<double>(now - started_at).count());
+    metric("l2sim_phases_completed", "gauge", "Phases of the message file run to completion", m.nr_phases_completed);
+    /*
+     * the counters of the simulator are reset at the start of every phase, which
+     * would be taken for counter resets, hence the l2sim_phase_* gauges
+     */
+    metric("l2sim_phase_segment_packets_transmitted", "gauge", "Packets containing segments transmitted this phase", m.packets_transmitted);
+    metric("l2sim_phase_segment_packet_distance", "gauge", "Distance covered by packets containing segments this phase", m.packets_distance);
+    metric("l2sim_phase_segment_packet_bytes", "gauge", "Bytes of packets containing segments transmitted this phase", m.packets_bytes);
+    metric("l2sim_phase_packets_transmitted", "gauge", "Packets transmitted this phase", m.total_packets_transmitted);
+    metric("l2sim_phase_packet_distance", "gauge", "Distance covered by packets this phase", m.total_packets_distance);
+    metric("l2sim_phase_packet_bytes", "gauge", "Bytes of packets transmitted this phase", m.total_packets_bytes);
+    // untagged packets are accounted as data or control
+    header("l2sim_phase_class_packets_transmitted", "gauge", "Packets transmitted this phase, by packet class");
+    for (size_t i = 1; i < m.class_packets.size(); ++i)
+        ss << "l2sim_phase_class_packets_transmitted{class=\"" << packet_class_name(static_cast<PacketClass>(i)) << "\"} " << m.class_packets[i] << '\n';
+    header("l2sim_phase_class_packet_bytes", "gauge", "Bytes of packets transmitted this phase, by packet class");
+    for (size_t i = 1; i < m.class_bytes.size(); ++i)
+        ss << "l2sim_phase_class_packet_bytes{class=\"" << packet_class_name(static_cast<PacketClass>(i)) << "\"} " << m.class_bytes[i] << '\n';
+    header("l2sim_phase_packets_dropped", "gauge", "Packets dropped this phase, at nodes or links that are down, by the queue policy or at nodes not receiving");
+    ss << "l2sim_phase_packets_dropped{reason=\"down\"} " << m.packets_dropped << '\n'
+       << "l2sim_phase_packets_dropped{reason=\"queue\"} " << m.packets_dropped_at_queues << '\n'
+       << "l2sim_phase_packets_dropped{reason=\"not-receiving\"} " << m.packets_dropped_unreceived << '\n';
+    metric("l2sim_phase_packets_refused", "gauge", "Packets refused by full queues applying backpressure this phase", m.packets_refused);
+    metric("l2sim_packets_in_flight", "gauge", "Packets queued at, or being processed by, nodes", m.packets_in_flight);
+    metric("l2sim_segment_packets_in_flight", "gauge", "Packets containing segments queued at, or being processed by, nodes", m.segment_packets_in_flight);
+    metric("l2sim_phase_segments_delivered", "gauge", "Segments delivered this phase", m.nr_segments_delivered);
+    metric("l2sim_phase_segments_expected", "gauge", "Segments to be delivered this phase", m.nr_segments_expected);
+    metric("l2sim_phase_routing_loops", "gauge", "Packets containing segments sent back to a node they went through this phase", m.nr_routing_loops);
+    metric("l2sim_packets_per_second", "gauge", "Packets transmitted per second since the previous sample", packets_per_second);
+    return ss.str();
+}
+
+void MetricsExporter::serve(std::string const& sample) const
+{
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0)
+        return;
+    for (size_t sent = 0; sent < sample.size();) {
+        ssize_t n = send(fd, sample.data() + sent, sample.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    close(fd);
+}
+
+void MetricsExporter::append(std::string const& sample)
+{
+    if (file_size > 0 && file_size + sample.size() > MAX_FILE_SIZE) {
+        file.close();
+        std::rename(path.c_str(), (path + ".1").c_str());
+        file.open(path, std::ios::trunc);
+        file_size = 0;
+    }
+    auto unix_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    std::string stamp = "# sampled at " + std::to_string(unix_ms) + '\n';
+    file << stamp << sample << std::flush;
+    file_size += stamp.size() + sample.size();
+}
@@ -0,0 +1,57 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "simulation.h"
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <thread>
+
+/*
+ * samples `Simulation::metrics` every `interval` on a thread of its own, at the lowest
+ * priority, which reads atomics only (so takes no lock of the simulator's and never
+ * stops the nodes) and exports them in the Prometheus text format to `target`, either
+ *  - "unix:PATH", a Unix domain socket that writes the latest sample to every client
+ *    that connects, then closes the connection, or
+ *  - a file that samples are appended to, rolled over to "FILE.1" once it grows
+ *    past `MAX_FILE_SIZE`
+ */
+class MetricsExporter {
+public:
+    static size_t constexpr MAX_FILE_SIZE = 16 << 20;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    Simulation const& simul;
+    std::chrono::milliseconds const interval;
+    Clock::time_point const started_at;
+
+    std::string path;
+    int listen_fd;
+    std::ofstream file;
+    size_t file_size;
+    // written to by the destructor to wake the sampler up
+    int wake_fds[2];
+    std::thread sampler;
+    void sample_loop();
+
+    // to compute rates from
+    Clock::time_point last_sampled_at;
+    size_t last_total_packets_transmitted;
+    std::string take_sample(Clock::time_point now);
+    std::string render(Simulation::Metrics const& m, double packets_per_second, Clock::time_point now) const;
+    void serve(std::string const& sample) const;
+    void append(std::string const& sample);
+
+public:
+    // throws `std::runtime_error` if `target` cannot be listened on or written to
+    MetricsExporter(Simulation const& simul, std::string const& target, std::chrono::milliseconds interval);
+    MetricsExporter(MetricsExporter const&) = delete;
+    MetricsExporter& operator=(MetricsExporter const&) = delete;
+    ~MetricsExporter();
+};
+
+#endif // METRICS_H
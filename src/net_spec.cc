@@ -0,0 +1,45 @@
+#include "net_spec.h"
+
+#include <stdexcept>
+#include <string>
+
+NetSpec NetSpec::parse(std::istream& net_spec)
+{
+    NetSpec s;
+    size_t nr_nodes, nr_edges;
+    net_spec >> nr_nodes;
+    if (nr_nodes > AddressIndex::MAX_INDEX)
+        throw std::invalid_argument("Bad network file: Too many nodes");
+    s.nodes.reserve(nr_nodes);
+    s.mac_to_index.reserve(nr_nodes);
+    s.ip_to_index.reserve(nr_nodes);
+    for (size_t i = 0; i < nr_nodes; ++i) {
+        MACAddress mac;
+        IPAddress ip;
+        net_spec >> mac >> ip;
+        if (!s.mac_to_index.insert(mac, i))
+            throw std::invalid_argument(std::string("Bad network file: MAC '") + std::to_string(mac) + "' repeated");
+        if (!s.ip_to_index.insert(ip, i))
+            throw std::invalid_argument(std::string("Bad network file: IP '") + std::to_string(ip) + "' repeated");
+        s.nodes.emplace_back(mac, ip);
+    }
+
+    net_spec >> nr_edges;
+    std::vector<Topology::Link> links;
+    links.reserve(nr_edges);
+    for (size_t i = 0; i < nr_edges; ++i) {
+        MACAddress m1, m2;
+        size_t distance;
+        net_spec >> m1 >> m2 >> distance;
+        auto i1 = s.mac_to_index.find(m1), i2 = s.mac_to_index.find(m2);
+        if (!i1.has_value() || !i2.has_value())
+            throw std::invalid_argument(std::string("Bad network file: Edge between (mac:") + std::to_string(m1) + "),(mac:" + std::to_string(m2) + ") is not between nodes");
+        if (distance > Topology::MAX_DISTANCE)
+            throw std::invalid_argument(std::string("Bad network file: Edge between (mac:") + std::to_string(m1) + "),(mac:" + std::to_string(m2) + ") too long");
+        links.emplace_back(i1.value(), i2.value(), distance);
+    }
+    auto repeated = s.topology.build(nr_nodes, links);
+    if (repeated.has_value())
+        throw std::invalid_argument(std::string("Bad network file: Edge between (mac:'") + std::to_string(s.nodes[repeated->first].first) + "),(mac:" + std::to_string(s.nodes[repeated->second].first) + ") repeated");
+    return s;
+}
@@ -0,0 +1,26 @@
+#ifndef NET_SPEC_H
+#define NET_SPEC_H
+
+#include "address_index.h"
+#include "node.h"
+#include "topology.h"
+
+#include <istream>
+#include <utility>
+#include <vector>
+
+/*
+ * a parsed and validated network file, which any number of simulations can be built from
+ */
+struct NetSpec {
+    // (mac, ip) of every node, by node index
+    std::vector<std::pair<MACAddress, IPAddress>> nodes;
+    AddressIndex mac_to_index;
+    AddressIndex ip_to_index;
+    Topology topology;
+
+    // throws `std::invalid_argument` on a bad network file
+    static NetSpec parse(std::istream& net_spec);
+};
+
+#endif // NET_SPEC_H
@@ -1,6 +1,7 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -10,6 +11,40 @@ struct Simulation;
 using MACAddress = uint32_t;
 using IPAddress = uint32_t;
 
+/*
+ * protocol message class of a packet, used by the simulator to break down
+ * packets, bytes and distance per class at the end of every phase
+ * `UNTAGGED` packets are accounted as `DATA` or `CONTROL` depending on `contains_segment`
+ */
+enum class PacketClass : uint8_t {
+    UNTAGGED,
+    DATA,
+    CONTROL,
+    HELLO,
+    LSA,
+    DISTANCE_VECTOR,
+    ACK,
+};
+
+/*
+ * what became of a packet handed to `send_packet`
+ *  - `SENT` once it is on its way (it may still be lost on a link or at a node that is down)
+ *  - `DROPPED` if the neighbour's inbound queue dropped it (see --queue-policy)
+ *  - `WOULD_BLOCK` if the neighbour's inbound queue is full and applies backpressure,
+ *    the packet was not sent and may be sent again later
+ */
+enum class SendStatus : uint8_t {
+    SENT,
+    DROPPED,
+    WOULD_BLOCK,
+};
+
+// of an inbound queue, `capacity` is 0 if the queues are unbounded
+struct QueueOccupancy {
+    size_t length;
+    size_t capacity;
+};
+
 class Node {
 private:
     Simulation* simul;
@@ -33,15 +68,24 @@ public:
      */
     virtual void do_periodic() { };
 
+    /*
+     * XXX implement these if the protocol state should be kept in simulator snapshots
+     * (see --save-snapshot), `deserialize` is given what `serialize` returned
+     */
+    virtual std::vector<uint8_t> serialize() const { return {}; }
+    virtual void deserialize(std::vector<uint8_t> const& state) { }
+
 protected:
     /*
      * use this to send a packet to a neighbor
      * set `contains_segment` to true to indicate to the simulator
      *      that this packet contains a segment
      *      (as opposed to protocol-related packets)
+     * optionally set `cls` to the kind of protocol message this packet carries
+     * returns whether the packet could be queued at the neighbour (see `SendStatus`)
      * for reference see node_impl/naive.cc
      */
-    void send_packet(MACAddress dest_mac, std::vector<uint8_t> const& packet, bool contains_segment) const;
+    SendStatus send_packet(MACAddress dest_mac, std::vector<uint8_t> const& packet, bool contains_segment, PacketClass cls = PacketClass::UNTAGGED) const;
 
     /*
      * use this in your implementation of receive_packet when you receive a segment
@@ -55,14 +99,38 @@ protected:
      * set `contains_segment` to true to indicate to the simulator
      *      that this packet contains a segment
      *      (as opposed to protocol-related packets)
+     * optionally set `cls` to the kind of protocol message this packet carries
+     * copies refused by full queues applying backpressure are dropped, use `send_packet`
+     *      for every neighbour to be able to send them again
      * for reference see node_impl/naive.cc
      */
-    void broadcast_packet_to_all_neighbors(std::vector<uint8_t> const& packet, bool contains_segment) const;
+    void broadcast_packet_to_all_neighbors(std::vector<uint8_t> const& packet, bool contains_segment, PacketClass cls = PacketClass::UNTAGGED) const;
+
+    /*
+     * use this to know how many packets wait in the inbound queue of this node, or of
+     * the neighbour `mac`, e.g. to pace what is sent to it
+     */
+    QueueOccupancy queue_occupancy(MACAddress mac) const;
 
     /*
      * use this for debugging (writes logs to a file named "node-`mac`.log")
      */
     void log(std::string) const;
+
+    /*
+     * use this to pick one of several equal-cost next hops (which must not be empty)
+     * by hashing the endpoints and `flow_key` (anything identifying a flow), so that
+     * the packets of a flow take the same path while flows are spread across paths
+     */
+    static MACAddress ecmp_next_hop(std::vector<MACAddress> const& next_hops, IPAddress src_ip, IPAddress dest_ip, uint64_t flow_key = 0)
+    {
+        // splitmix64 finaliser
+        uint64_t h = (uint64_t(src_ip) << 32 | dest_ip) ^ (flow_key * 0x9e3779b97f4a7c15);
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+        h ^= h >> 31;
+        return next_hops[h % next_hops.size()];
+    }
 };
 
 #endif // NODE_H
@@ -0,0 +1,18 @@
+#include "node_arena.h"
+
+Node* NodeArena::emplace(Simulation* simul, MACAddress mac, IPAddress ip)
+{
+    if (count % CHUNK_SIZE == 0)
+        chunks.emplace_back(new std::byte[CHUNK_SIZE * stride]);
+    std::byte* at = chunks.back().get() + (count % CHUNK_SIZE) * stride;
+    Node* node = construct(at, simul, mac, ip);
+    node_offset = reinterpret_cast<std::byte*>(node) - at;
+    count++;
+    return node;
+}
+
+NodeArena::~NodeArena()
+{
+    for (size_t i = 0; i < count; ++i)
+        (*this)[i]->~Node();
+}
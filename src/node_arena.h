@@ -0,0 +1,64 @@
+#ifndef NODE_ARENA_H
+#define NODE_ARENA_H
+
+#include "node.h"
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/*
+ * `Node` objects of a single type placed back to back in fixed-size chunks,
+ * indexed by node index; addresses stay valid as nodes are added
+ */
+class NodeArena {
+public:
+    static size_t constexpr CHUNK_SIZE = 4096;
+
+private:
+    using Construct = Node* (*)(void* at, Simulation* simul, MACAddress mac, IPAddress ip);
+    size_t const stride;
+    Construct const construct;
+    // of the `Node` base within the node type
+    std::ptrdiff_t node_offset;
+    std::vector<std::unique_ptr<std::byte[]>> chunks;
+    size_t count;
+
+    NodeArena(size_t stride, Construct construct)
+        : stride(stride), construct(construct), node_offset(0), count(0) { }
+
+public:
+    template <class T>
+    static std::unique_ptr<NodeArena> of()
+    {
+        static_assert(std::is_base_of_v<Node, T>, "only nodes are placed in a node arena");
+        static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "chunks are only aligned as returned by new");
+        return std::unique_ptr<NodeArena>(new NodeArena(sizeof(T), [](void* at, Simulation* simul, MACAddress mac, IPAddress ip) -> Node* {
+            return new (at) T(simul, mac, ip);
+        }));
+    }
+    NodeArena(NodeArena const&) = delete;
+    NodeArena& operator=(NodeArena const&) = delete;
+    ~NodeArena();
+
+    size_t size() const { return count; }
+    Node* operator[](size_t index) const
+    {
+        return reinterpret_cast<Node*>(chunks[index / CHUNK_SIZE].get() + (index % CHUNK_SIZE) * stride + node_offset);
+    }
+    // `T` must be the type the arena was made `of`
+    template <class T>
+    T& at(size_t index) const
+    {
+        return *std::launder(reinterpret_cast<T*>(chunks[index / CHUNK_SIZE].get() + (index % CHUNK_SIZE) * sizeof(T)));
+    }
+
+    /*
+     * constructs the node with index `size()`
+     */
+    Node* emplace(Simulation* simul, MACAddress mac, IPAddress ip);
+};
+
+#endif // NODE_ARENA_H
@@ -2,7 +2,7 @@
 
 #include <cstring>
 
-#define MAX_TTL 5
+static size_t constexpr MAX_TTL = 5;
 
 /*
  * DON'T DO THIS, this is just illustrative of how to extend the Node class
@@ -10,6 +10,7 @@
  * with a TTL to ensure packets don't last forever
  */
 
+namespace {
 struct BlasterPacketHeader {
 private:
     BlasterPacketHeader() = default;
@@ -28,6 +29,7 @@ public:
         return ph;
     }
 };
+}
 
 void BlasterNode::send_segment(IPAddress dest_ip, std::vector<uint8_t> const& segment) const
 {
@@ -35,7 +37,7 @@ void BlasterNode::send_segment(IPAddress dest_ip, std::vector<uint8_t> const& se
     std::vector<uint8_t> packet(sizeof(ph) + segment.size());
     memcpy(&packet[0], &ph, sizeof(ph));
     memcpy(&packet[sizeof(ph)], &segment[0], segment.size());
-    broadcast_packet_to_all_neighbors(packet, /*contains_segment*/ true);
+    broadcast_packet_to_all_neighbors(packet, /*contains_segment*/ true, PacketClass::DATA);
 }
 void BlasterNode::receive_packet(MACAddress src_mac, std::vector<uint8_t> packet, size_t distance)
 {
@@ -48,6 +50,6 @@ void BlasterNode::receive_packet(MACAddress src_mac, std::vector<uint8_t> packet
     else {
         ph.ttl--;
         memcpy(&packet[0], &ph, sizeof(ph));
-        broadcast_packet_to_all_neighbors(packet, /*contains_segment*/ true);
+        broadcast_packet_to_all_neighbors(packet, /*contains_segment*/ true, PacketClass::DATA);
     }
 }
@@ -0,0 +1,57 @@
+#include "blaster_coro.h"
+
+#include <cstring>
+
+static size_t constexpr MAX_TTL = 5;
+
+/*
+ * blaster written against the coroutine API, for reference as to how to use it
+ * it also logs how many packets it forwarded every second
+ */
+
+static auto constexpr REPORT_INTERVAL = std::chrono::seconds(1);
+
+namespace {
+struct BlasterPacketHeader {
+    IPAddress src_ip;
+    IPAddress dest_ip;
+    size_t ttl;
+};
+}
+
+void BlasterCoroNode::send_segment(IPAddress dest_ip, std::vector<uint8_t> const& segment) const
+{
+    BlasterPacketHeader ph { ip, dest_ip, MAX_TTL };
+    std::vector<uint8_t> packet(sizeof(ph) + segment.size());
+    memcpy(&packet[0], &ph, sizeof(ph));
+    memcpy(&packet[sizeof(ph)], &segment[0], segment.size());
+    broadcast_packet_to_all_neighbors(packet, /*contains_segment*/ true, PacketClass::DATA);
+}
+
+CoroNode::Task BlasterCoroNode::run()
+{
+    size_t nr_forwarded = 0;
+    Clock::time_point report_at = Clock::now() + REPORT_INTERVAL;
+    for (;;) {
+        auto p = co_await any_of(recv(), sleep_until(report_at));
+        if (!p.has_value()) {
+            log("Forwarded " + std::to_string(nr_forwarded) + " packet(s)");
+            report_at += REPORT_INTERVAL;
+            continue;
+        }
+
+        BlasterPacketHeader ph;
+        memcpy(&ph, &p->packet[0], sizeof(ph));
+        if (ph.dest_ip == ip) {
+            std::vector<uint8_t> segment(p->packet.begin() + sizeof(ph), p->packet.end());
+            receive_segment(ph.src_ip, segment);
+        } else if (ph.ttl == 0)
+            log("Packet dropped");
+        else {
+            ph.ttl--;
+            memcpy(&p->packet[0], &ph, sizeof(ph));
+            broadcast_packet_to_all_neighbors(p->packet, /*contains_segment*/ true, PacketClass::DATA);
+            nr_forwarded++;
+        }
+    }
+}
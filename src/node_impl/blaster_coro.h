@@ -0,0 +1,16 @@
+#ifndef BLASTER_CORO_H
+#define BLASTER_CORO_H
+
+#include "../coro_node.h"
+
+class BlasterCoroNode : public CoroNode {
+public:
+    BlasterCoroNode(Simulation* simul, MACAddress mac, IPAddress ip) : CoroNode(simul, mac, ip) { }
+
+    void send_segment(IPAddress dest_ip, std::vector<uint8_t> const& segment) const override;
+
+protected:
+    Task run() override;
+};
+
+#endif // BLASTER_CORO_H
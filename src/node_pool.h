@@ -0,0 +1,451 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include "node_runtime.h"
+#include "simulation.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * compact mode: node callbacks run on a fixed pool of worker threads
+ * and the per-node state is kept in arrays indexed by node index
+ *  - `scheduled` (a byte per node) is held while the node is queued for, or run by,
+ *    a worker, and doubles as the lock serialising the node's callbacks
+ *  - the inbound queue of a node (`NodeState`) is only allocated once it first
+ *    receives a packet, and freed once receiving is parked with the queue drained
+ *    (its RED average then restarts from 0)
+ *  - the log of a node is only allocated once it first logs, if logging is enabled
+ *  - every worker calls `do_periodic` on its share of the nodes in turn
+ * `Sim` is the `NodeSimulation` run, whose callbacks are called directly
+ */
+template <class Sim>
+class PooledRuntime : public NodeRuntime {
+private:
+    static auto constexpr PERIODIC_INTERVAL = std::chrono::microseconds(100);
+    // nodes swept before checking for packets to process again
+    static size_t constexpr SWEEP_BATCH = 256;
+
+    Sim* const sim;
+
+    struct NodeState {
+        std::mutex mt;
+        std::vector<Simulation::PacketReceivedInfo> inbound;
+        QueueGate gate;
+
+        explicit NodeState(size_t index)
+            : gate(index) { }
+    };
+    size_t nr_nodes;
+    std::unique_ptr<std::atomic<NodeState*>[]> states;
+    std::unique_ptr<std::atomic<bool>[]> scheduled;
+    struct LogState {
+        std::once_flag opened;
+        NodeLog log;
+    };
+    // only if `log_enabled`
+    std::unique_ptr<std::atomic<LogState*>[]> logs;
+    NodeState& state(size_t index);
+    // of nodes with nothing queued, only once nothing runs
+    void free_drained_states();
+
+    size_t const nr_workers;
+    std::vector<std::thread> workers;
+    void worker_loop(size_t w);
+
+    // guards `run_queue`, `nr_running`, `nr_nodes` and `exiting`
+    std::mutex run_mt;
+    std::condition_variable run_cv;
+    std::deque<uint32_t> run_queue;
+    // workers running a node taken off `run_queue`
+    size_t nr_running;
+    bool exiting;
+
+    /*
+     * `nr_pending` counts packets accepted but not processed yet, `nr_sweeping`
+     * the workers calling `do_periodic`; both are raised before checking the
+     * corresponding `*_on` flag, so that parking only has to wait for them to drop to 0
+     * (receiving is parked once `recv_on` is cleared and `nr_pending` drops to 0)
+     * nodes below `nr_parked` drop what they are sent once `recv_on` is cleared
+     */
+    std::atomic<bool> recv_on;
+    std::atomic<size_t> nr_parked;
+    std::atomic<size_t> nr_pending;
+    std::atomic<bool> periodic_on;
+    std::atomic<size_t> nr_sweeping;
+    std::condition_variable parked_cv;
+    void packet_done();
+
+    void schedule(size_t index);
+    void acquire(size_t index);
+    void release(size_t index);
+    void run_node(size_t index);
+    void sweep(size_t begin, size_t end);
+
+public:
+    PooledRuntime(Sim* simul, NodeArena const& nodes, LivenessSet const& liveness, Profiler* profiler, bool log_enabled, std::string log_file_prefix, size_t nr_workers);
+    ~PooledRuntime() override;
+
+    void add_nodes() override;
+
+    void launch_recv() override;
+    void launch_periodic() override;
+    void end_recv() override;
+    void end_periodic() override;
+    void wait_recv_parked() override;
+    void wait_periodic_parked() override;
+
+    void send_segment(size_t index, Simulation::SegmentToSendInfo const& f) override;
+    SendStatus receive_packet(size_t index, Simulation::PacketReceivedInfo&& f) override;
+    size_t queue_length(size_t index) override;
+    size_t drop_inbound(size_t index) override;
+    bool log(size_t index, std::string logline) override;
+};
+
+template <class Sim>
+PooledRuntime<Sim>::PooledRuntime(Sim* simul, NodeArena const& nodes, LivenessSet const& liveness, Profiler* profiler, bool log_enabled, std::string log_file_prefix, size_t nr_workers)
+    : NodeRuntime(simul, nodes, liveness, profiler, log_enabled, log_file_prefix), sim(simul),
+      nr_nodes(0), nr_workers(std::max<size_t>(nr_workers, 1)), nr_running(0), exiting(false),
+      recv_on(false), nr_parked(0), nr_pending(0), periodic_on(false), nr_sweeping(0)
+{
+    for (size_t w = 0; w < this->nr_workers; ++w)
+        workers.emplace_back(&PooledRuntime<Sim>::worker_loop, this, w);
+}
+
+template <class Sim>
+PooledRuntime<Sim>::~PooledRuntime()
+{
+    end_periodic();
+    end_recv();
+    wait_periodic_parked();
+    wait_recv_parked();
+    {
+        std::lock_guard<std::mutex> lg(run_mt);
+        exiting = true;
+    }
+    run_cv.notify_all();
+    for (auto& t : workers)
+        t.join();
+    for (size_t i = 0; i < nr_nodes; ++i) {
+        delete states[i].load();
+        if (logs != nullptr)
+            delete logs[i].load();
+    }
+}
+
+template <class Sim>
+void PooledRuntime<Sim>::add_nodes()
+{
+    std::lock_guard<std::mutex> lg(run_mt);
+    size_t n = nodes.size();
+    if (n <= nr_nodes)
+        return;
+    std::unique_ptr<std::atomic<NodeState*>[]> s(new std::atomic<NodeState*>[n]);
+    std::unique_ptr<std::atomic<bool>[]> b(new std::atomic<bool>[n]);
+    for (size_t i = 0; i < n; ++i) {
+        s[i] = (i < nr_nodes ? states[i].load() : nullptr);
+        b[i] = (i < nr_nodes ? scheduled[i].load() : false);
+    }
+    states = std::move(s);
+    scheduled = std::move(b);
+    if (log_enabled) {
+        std::unique_ptr<std::atomic<LogState*>[]> l(new std::atomic<LogState*>[n]);
+        for (size_t i = 0; i < n; ++i)
+            l[i] = (i < nr_nodes ? logs[i].load() : nullptr);
+        logs = std::move(l);
+    }
+    nr_nodes = n;
+}
+
+template <class Sim>
+typename PooledRuntime<Sim>::NodeState& PooledRuntime<Sim>::state(size_t index)
+{
+    NodeState* st = states[index].load(std::memory_order_acquire);
+    if (st != nullptr)
+        return *st;
+    NodeState* fresh = new NodeState(index);
+    if (states[index].compare_exchange_strong(st, fresh, std::memory_order_acq_rel))
+        return *fresh;
+    delete fresh;
+    return *st;
+}
+
+template <class Sim>
+void PooledRuntime<Sim>::free_drained_states()
+{
+    for (size_t i = 0; i < nr_nodes; ++i) {
+        NodeState* st = states[i].load(std::memory_order_relaxed);
+        if (st != nullptr && st->inbound.empty()) {
+            states[i] = nullptr;
+            delete st;
+        }
+    }
+}
+
+template <class Sim>
+void PooledRuntime<Sim>::schedule(size_t index)
+{
+    if (scheduled[index].exchange(true))
+        return;
+    {
+        std::lock_guard<std::mutex> lg(run_mt);
+        run_queue.push_back(index);
+    }
+    run_cv.notify_one();
+}
+template <class Sim>
+void PooledRuntime<Sim>::acquire(size_t index)
+{
+    while (scheduled[index].exchange(true))
+        std::this_thread::yield();
+}
+template <class Sim>
+void PooledRuntime<Sim>::release(size_t index)
+{
+    scheduled[index] = false;
+    /*
+     * packets that arrived meanwhile were not scheduled by their senders
+     */
+    NodeState* st = states[index].load(std::memory_order_acquire);
+    if (st == nullptr)
+        return;
+    bool pending;
+    {
+        std::lock_guard<std::mutex> lg(st->mt);
+        pending = !st->inbound.empty();
+    }
+    if (pending)
+        schedule(index);
+}
+
+template <class Sim>
+void PooledRuntime<Sim>::run_node(size_t index)
+{
+    NodeState& st = state(index);
+    while (true) {
+        std::vector<Simulation::PacketReceivedInfo> batch;
+        {
+            Profiler::Scope ps(profiler, ProfileStage::QUEUE);
+            std::lock_guard<std::mutex> lg(st.mt);
+            batch.swap(st.inbound);
+        }
+        if (batch.empty())
+            break;
+        for (auto& f : batch) {
+            sim->run_receive_callback(index, f);
+            simul->packet_processed(f.contains_segment);
+            packet_done();
+        }
+    }
+    release(index);
+}
+
+template <class Sim>
+void PooledRuntime<Sim>::sweep(size_t begin, size_t end)
+{
+    nr_sweeping++;
+    for (size_t i = begin; i < end && periodic_on; ++i) {
+        // nodes that are busy skip this round
+        if (!liveness.test(i) || scheduled[i].exchange(true))
+            continue;
+        sim->run_periodic_callback(i);
+        release(i);
+    }
+    if (--nr_sweeping == 0 && !periodic_on) {
+        std::lock_guard<std::mutex> lg(run_mt);
+        parked_cv.notify_all();
+    }
+}
+
+template <class Sim>
+void PooledRuntime<Sim>::worker_loop(size_t w)
+{
+    auto next_sweep = std::chrono::steady_clock::now();
+    size_t swept = 0;
+    std::unique_lock<std::mutex> ul(run_mt);
+    while (!exiting) {
+        if (!run_queue.empty()) {
+            size_t index = run_queue.front();
+            run_queue.pop_front();
+            nr_running++;
+            ul.unlock();
+            run_node(index);
+            ul.lock();
+            if (--nr_running == 0 && !recv_on)
+                parked_cv.notify_all();
+        } else if (periodic_on && std::chrono::steady_clock::now() >= next_sweep) {
+            size_t begin = nr_nodes * w / nr_workers, end = nr_nodes * (w + 1) / nr_workers;
+            size_t from = begin + swept, to = std::min(end, from + SWEEP_BATCH);
+            ul.unlock();
+            sweep(from, to);
+            if (to >= end) {
+                swept = 0;
+                next_sweep = std::chrono::steady_clock::now() + PERIODIC_INTERVAL;
+            } else
+                swept = to - begin;
+            ul.lock();
+        } else if (periodic_on)
+            run_cv.wait_until(ul, next_sweep);
+        else
+            run_cv.wait(ul);
+    }
+}
+
+template <class Sim>
+void PooledRuntime<Sim>::launch_recv()
+{
+    nr_parked = 0;
+    recv_on = true;
+}
+template <class Sim>
+void PooledRuntime<Sim>::launch_periodic()
+{
+    {
+        std::lock_guard<std::mutex> lg(run_mt);
+        periodic_on = true;
+    }
+    run_cv.notify_all();
+}
+template <class Sim>
+void PooledRuntime<Sim>::end_recv()
+{
+    recv_on = false;
+    /*
+     * between batches a node is idle even while packets are still flooding through it,
+     * so it is only parked once no node at all is waiting for a worker
+     */
+    auto busy = [this](size_t i) {
+        std::lock_guard<std::mutex> lg(run_mt);
+        return !run_queue.empty() || scheduled[i] || queue_length(i) > 0;
+    };
+    for (size_t i = 0; i < nr_nodes; ++i) {
+        while (busy(i))
+            std::this_thread::yield();
+        nr_parked = i + 1;
+    }
+}
+template <class Sim>
+void PooledRuntime<Sim>::end_periodic()
+{
+    periodic_on = false;
+}
+template <class Sim>
+void PooledRuntime<Sim>::wait_recv_parked()
+{
+    std::unique_lock<std::mutex> ul(run_mt);
+    parked_cv.wait(ul, [this] { return nr_pending == 0 && nr_running == 0 && run_queue.empty(); });
+    if (!periodic_on && nr_sweeping == 0)
+        free_drained_states();
+}
+template <class Sim>
+void PooledRuntime<Sim>::wait_periodic_parked()
+{
+    std::unique_lock<std::mutex> ul(run_mt);
+    parked_cv.wait(ul, [this] { return nr_sweeping == 0; });
+}
+
+template <class Sim>
+void PooledRuntime<Sim>::packet_done()
+{
+    if (--nr_pending == 0 && !recv_on) {
+        std::lock_guard<std::mutex> lg(run_mt);
+        parked_cv.notify_all();
+    }
+}
+
+template <class Sim>
+void PooledRuntime<Sim>::send_segment(size_t index, Simulation::SegmentToSendInfo const& f)
+{
+    if (!liveness.test(index))
+        return;
+    acquire(index);
+    sim->run_send_segment(index, f);
+    release(index);
+}
+
+template <class Sim>
+SendStatus PooledRuntime<Sim>::receive_packet(size_t index, Simulation::PacketReceivedInfo&& f)
+{
+    Profiler::Scope ps(profiler, ProfileStage::QUEUE);
+    // as with a receive thread per node, packets are only dropped once the node is parked
+    ++nr_pending;
+    if (!recv_on && index < nr_parked) {
+        packet_done();
+        simul->packet_dropped_at_queue(/*by_policy*/ false);
+        return SendStatus::DROPPED;
+    }
+    NodeState& st = state(index);
+    SendStatus s;
+    {
+        std::lock_guard<std::mutex> lg(st.mt);
+        s = st.gate.admit(limit, st.inbound.size());
+        if (s == SendStatus::SENT) {
+            simul->packet_enqueued(f.contains_segment);
+            st.inbound.push_back(std::move(f));
+        }
+    }
+    if (s != SendStatus::SENT) {
+        if (s == SendStatus::DROPPED)
+            simul->packet_dropped_at_queue(/*by_policy*/ true);
+        packet_done();
+        return s;
+    }
+    schedule(index);
+    return SendStatus::SENT;
+}
+
+template <class Sim>
+size_t PooledRuntime<Sim>::queue_length(size_t index)
+{
+    NodeState* st = states[index].load(std::memory_order_acquire);
+    if (st == nullptr)
+        return 0;
+    std::lock_guard<std::mutex> lg(st->mt);
+    return st->inbound.size();
+}
+
+template <class Sim>
+size_t PooledRuntime<Sim>::drop_inbound(size_t index)
+{
+    NodeState* st = states[index].load(std::memory_order_acquire);
+    if (st == nullptr)
+        return 0;
+    std::vector<Simulation::PacketReceivedInfo> q;
+    {
+        std::lock_guard<std::mutex> lg(st->mt);
+        q.swap(st->inbound);
+    }
+    for (auto const& f : q) {
+        simul->packet_processed(f.contains_segment);
+        packet_done();
+    }
+    return q.size();
+}
+
+template <class Sim>
+bool PooledRuntime<Sim>::log(size_t index, std::string logline)
+{
+    if (!log_enabled)
+        return true;
+    LogState* ls = logs[index].load(std::memory_order_acquire);
+    if (ls == nullptr) {
+        LogState* fresh = new LogState;
+        if (logs[index].compare_exchange_strong(ls, fresh, std::memory_order_acq_rel))
+            ls = fresh;
+        else
+            delete fresh;
+    }
+    std::call_once(ls->opened, [&] { ls->log.open(log_path(index)); });
+    return ls->log.write(logline);
+}
+
+#endif // NODE_POOL_H
@@ -0,0 +1,26 @@
+#include "node_runtime.h"
+
+#include <fstream>
+#include <iomanip>
+
+static size_t constexpr MAX_NODE_LOG_LINES = 20000;
+
+void NodeLog::open(std::string const& path)
+{
+    out = std::make_unique<std::ofstream>(path);
+    (*out) << std::setprecision(2) << std::fixed;
+}
+
+bool NodeLog::write(std::string const& logline)
+{
+    std::lock_guard<std::mutex> lg(mt);
+    if (out == nullptr)
+        return true;
+    else if (lineno >= MAX_NODE_LOG_LINES) {
+        out.reset();
+        return false;
+    }
+    (*out) << '[' << lineno++ << "] " << logline << '\n'
+           << std::flush;
+    return true;
+}
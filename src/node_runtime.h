@@ -0,0 +1,93 @@
+#ifndef NODE_RUNTIME_H
+#define NODE_RUNTIME_H
+
+#include "liveness.h"
+#include "node_arena.h"
+#include "profiler.h"
+#include "queue_limit.h"
+#include "simulation.h"
+
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+/*
+ * per-node log file, closed for good once too many lines have been written
+ */
+struct NodeLog {
+    std::mutex mt;
+    std::unique_ptr<std::ostream> out;
+    size_t lineno = 1;
+
+    void open(std::string const& path);
+    /*
+     * returns false when the log limit is exceeded for the first time
+     */
+    bool write(std::string const& logline);
+};
+
+/*
+ * runs the callbacks of the nodes in `nodes`
+ * we need to ensure that `send_segment`, `receive_packet` and `do_periodic` calls on
+ * a node are synchronised so that the extended implementation does not have to perform
+ * locking on data structures
+ */
+class NodeRuntime {
+protected:
+    Simulation* const simul;
+    NodeArena const& nodes;
+    LivenessSet const& liveness;
+    Profiler* const profiler;
+    bool const log_enabled;
+    std::string const log_file_prefix;
+    QueueLimit limit;
+
+    std::string log_path(size_t index) const { return log_file_prefix + std::to_string(nodes[index]->mac) + ".log"; }
+
+public:
+    NodeRuntime(Simulation* simul, NodeArena const& nodes, LivenessSet const& liveness, Profiler* profiler, bool log_enabled, std::string log_file_prefix)
+        : simul(simul), nodes(nodes), liveness(liveness), profiler(profiler), log_enabled(log_enabled), log_file_prefix(log_file_prefix) { }
+    virtual ~NodeRuntime() = default;
+
+    /*
+     * takes on the nodes of `nodes` it does not run yet, only called between phases
+     */
+    virtual void add_nodes() = 0;
+    // only called between phases
+    void set_queue_limit(QueueLimit limit) { this->limit = limit; }
+    QueueLimit const& queue_limit() const { return limit; }
+
+    virtual void launch_recv() = 0;
+    virtual void launch_periodic() = 0;
+    /*
+     * `end_periodic` only asks the nodes to stop, `wait_*_parked` waits for them to do so
+     * `end_recv` parks the receivers one at a time in node order, each once its queue is
+     * empty, the others receiving meanwhile: packets kept in flight for ever (e.g. by a
+     * protocol without TTLs) then die out at parked nodes, which drop them
+     */
+    virtual void end_recv() = 0;
+    virtual void end_periodic() = 0;
+    virtual void wait_recv_parked() = 0;
+    virtual void wait_periodic_parked() = 0;
+
+    virtual void send_segment(size_t index, Simulation::SegmentToSendInfo const& f) = 0;
+    /*
+     * queues the packet at the node and returns `SENT`, unless the node is not receiving
+     * (`DROPPED`) or its queue is full as per `limit`, in which case `f` is left as is
+     * drops are reported through `Simulation::packet_dropped_at_queue`
+     */
+    virtual SendStatus receive_packet(size_t index, Simulation::PacketReceivedInfo&& f) = 0;
+    // packets waiting in the node's inbound queue
+    virtual size_t queue_length(size_t index) = 0;
+    /*
+     * releases whatever is queued at the node, returns the number of packets dropped
+     */
+    virtual size_t drop_inbound(size_t index) = 0;
+    /*
+     * returns false when the node's log limit is exceeded for the first time
+     */
+    virtual bool log(size_t index, std::string logline) = 0;
+};
+
+#endif // NODE_RUNTIME_H
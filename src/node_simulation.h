@@ -0,0 +1,60 @@
+#ifndef NODE_SIMULATION_H
+#define NODE_SIMULATION_H
+
+#include "node_pool.h"
+#include "node_work.h"
+#include "simulation.h"
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+/*
+ * simulation of nodes of type `NodeT`, stored by value in the arena
+ * the runtime is instantiated for this (final) class, so that it calls `NodeT`'s
+ * callbacks directly, which may be inlined, without any virtual call per packet
+ */
+template <class NodeT>
+class NodeSimulation final : public Simulation {
+    static_assert(std::is_base_of_v<Node, NodeT>, "only nodes are simulated");
+
+private:
+    NodeT& node(size_t index) const { return nodes->template at<NodeT>(index); }
+
+public:
+    /*
+     * `nr_workers` is 0 for a receive and a periodic thread per node,
+     * otherwise nodes are run in compact mode by that many worker threads
+     */
+    NodeSimulation(NT node_type, bool log_enabled, std::string logfile_prefix, NetSpec const& net_spec, size_t delay_ms, bool grading_view, std::ostream* segment_trace_out, EventTracer* tracer, Profiler* profiler, size_t nr_workers)
+        : Simulation(NodeArena::of<NodeT>(), node_type, log_enabled, std::move(logfile_prefix), net_spec, delay_ms, grading_view, segment_trace_out, tracer, profiler)
+    {
+        if (nr_workers == 0)
+            start_runtime(std::make_unique<ThreadedRuntime<NodeSimulation>>(this, *nodes, liveness, profiler, node_log_enabled, node_log_file_prefix));
+        else
+            start_runtime(std::make_unique<PooledRuntime<NodeSimulation>>(this, *nodes, liveness, profiler, node_log_enabled, node_log_file_prefix, nr_workers));
+    }
+    ~NodeSimulation() override { stop_runtime(); }
+
+    /*
+     * callbacks of the node with index `index`, traced and profiled, for the runtime
+     * to call (which is responsible for serialising them per node)
+     */
+    void run_send_segment(size_t index, SegmentToSendInfo const& f)
+    {
+        NodeT& n = node(index);
+        traced_send_segment(n.mac, f, [&] { n.NodeT::send_segment(f.dest_ip, f.segment); });
+    }
+    void run_receive_callback(size_t index, PacketReceivedInfo& f)
+    {
+        NodeT& n = node(index);
+        traced_receive_callback(n.mac, f, [&] { n.NodeT::receive_packet(f.src_mac, std::move(f.packet), f.dist); });
+    }
+    void run_periodic_callback(size_t index)
+    {
+        NodeT& n = node(index);
+        traced_periodic_callback(n.mac, [&] { n.NodeT::do_periodic(); });
+    }
+};
+
+#endif // NODE_SIMULATION_H
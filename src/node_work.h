@@ -1,76 +1,345 @@
 #ifndef NODE_WORK_H
 #define NODE_WORK_H
 
+#include "liveness.h"
 #include "node.h"
+#include "node_runtime.h"
+#include "profiler.h"
+#include "simulation.h"
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
+#include <memory>
 #include <mutex>
-#include <ostream>
+#include <optional>
 #include <queue>
+#include <string>
 #include <thread>
+#include <vector>
 
+/*
+ * a receive thread and a periodic thread per node
+ * `Sim` is the `NodeSimulation` run, whose callbacks are called directly
+ */
+template <class Sim>
 class NodeWork {
 public:
-    // we need to ensure that `send_segment` and `receive_packet` calls on `node`
-    // are synchronised so that the extended implementation does not have to perform
-    // locking on data structures
     std::mutex node_mt;
-    Node* node;
-    bool is_up;
-
-    struct SegmentToSendInfo {
-        IPAddress dest_ip;
-        std::vector<uint8_t> segment;
-        SegmentToSendInfo(IPAddress ip, std::vector<uint8_t> const& segment) : dest_ip(ip), segment(segment) { }
-    };
+    size_t const index;
 
 private:
-    struct PacketReceivedInfo {
-        MACAddress src_mac;
-        size_t dist;
-        std::vector<uint8_t> packet;
-        PacketReceivedInfo(MACAddress src_mac, size_t dist, std::vector<uint8_t> const& packet)
-            : src_mac(src_mac), dist(dist), packet(packet) { }
-    };
-
-    std::queue<PacketReceivedInfo> inbound;
+    Sim* const simul;
+    LivenessSet const& liveness;
+
+    /*
+     * threads are launched once and parked between phases (and while the node is down)
+     * `*_running` are set by `launch_*` and cleared by the thread once it has parked
+     */
+    std::queue<Simulation::PacketReceivedInfo> inbound;
     std::mutex inbound_mt;
+    QueueLimit const& limit;
+    QueueGate gate;
     std::condition_variable inbound_cv;
     std::thread receive_thread;
     void receive_loop();
     bool recv_on;
+    bool recv_running;
 
-    std::vector<SegmentToSendInfo> outbound;
-
+    std::mutex periodic_mt;
+    std::condition_variable periodic_cv;
     std::thread periodic_thread;
     void periodic_loop();
-    bool periodic_on;
+    std::atomic<bool> periodic_on;
+    bool periodic_running;
+
+    std::atomic<bool> exiting;
 
-    mutable std::mutex log_mt;
-    size_t loglineno;
-    std::ostream* logger;
+    Profiler* const profiler;
 
 public:
-    NodeWork(Node* node, std::ostream* logger)
-        : node(node), is_up(true),
-          recv_on(false), periodic_on(false),
-          loglineno(1), logger(logger)
+    NodeLog logger;
+
+    NodeWork(Sim* simul, LivenessSet const& liveness, size_t index, QueueLimit const& limit, Profiler* profiler)
+        : index(index), simul(simul), liveness(liveness), limit(limit), gate(index),
+          recv_on(false), recv_running(false),
+          periodic_on(false), periodic_running(false), exiting(false),
+          profiler(profiler)
     {
     }
     ~NodeWork();
 
-    void send_segments();
+    bool is_up() const { return liveness.test(index); }
+
+    void send_segment(Simulation::SegmentToSendInfo const& f);
     void launch_recv();
     void launch_periodic();
     void end_recv();
     void end_periodic();
+    void wait_recv_parked();
+    void wait_periodic_parked();
+
+    SendStatus receive_packet(Simulation::PacketReceivedInfo&& f);
+    size_t queue_length();
+    size_t drop_inbound();
+};
 
-    void add_to_send_segment_queue(std::vector<SegmentToSendInfo> const& outbound);
-    void add_to_send_segment_queue(SegmentToSendInfo outbound);
+template <class Sim>
+class ThreadedRuntime : public NodeRuntime {
+private:
+    Sim* const sim;
+    std::vector<std::unique_ptr<NodeWork<Sim>>> works;
+
+public:
+    ThreadedRuntime(Sim* sim, NodeArena const& nodes, LivenessSet const& liveness, Profiler* profiler, bool log_enabled, std::string log_file_prefix)
+        : NodeRuntime(sim, nodes, liveness, profiler, log_enabled, log_file_prefix), sim(sim) { }
+
+    void add_nodes() override;
 
-    void receive_packet(MACAddress src_mac, std::vector<uint8_t> const& packet, size_t dist);
-    bool log(std::string logline);
+    /*
+     * all nodes are launched, and their periodic calls parked, concurrently
+     */
+    void launch_recv() override;
+    void launch_periodic() override;
+    void end_recv() override;
+    void end_periodic() override;
+    void wait_recv_parked() override;
+    void wait_periodic_parked() override;
+
+    void send_segment(size_t index, Simulation::SegmentToSendInfo const& f) override { works[index]->send_segment(f); }
+    SendStatus receive_packet(size_t index, Simulation::PacketReceivedInfo&& f) override { return works[index]->receive_packet(std::move(f)); }
+    size_t queue_length(size_t index) override { return works[index]->queue_length(); }
+    size_t drop_inbound(size_t index) override { return works[index]->drop_inbound(); }
+    bool log(size_t index, std::string logline) override { return works[index]->logger.write(logline); }
 };
 
+template <class Sim>
+void NodeWork<Sim>::send_segment(Simulation::SegmentToSendInfo const& f)
+{
+    if (!is_up())
+        return;
+    std::lock_guard<std::mutex> lg(node_mt);
+    simul->run_send_segment(index, f);
+}
+
+template <class Sim>
+void NodeWork<Sim>::receive_loop()
+{
+    std::unique_lock<std::mutex> ul(inbound_mt);
+    while (true) {
+        inbound_cv.wait(ul, [this] { return recv_running || exiting; });
+        if (exiting)
+            break;
+        while (true) {
+            inbound_cv.wait(ul, [this] { return inbound.size() > 0 || !recv_on; });
+            if (inbound.size() == 0 && !recv_on)
+                break;
+            while (inbound.size() > 0) {
+                std::optional<Simulation::PacketReceivedInfo> f;
+                {
+                    Profiler::Scope ps(profiler, ProfileStage::QUEUE);
+                    f.emplace(std::move(inbound.front()));
+                    inbound.pop();
+                }
+                ul.unlock();
+                node_mt.lock();
+                simul->run_receive_callback(index, f.value());
+                node_mt.unlock();
+                simul->packet_processed(f->contains_segment);
+                ul.lock();
+            }
+        }
+        recv_running = false;
+        inbound_cv.notify_all();
+    }
+}
+
+template <class Sim>
+void NodeWork<Sim>::periodic_loop()
+{
+    std::unique_lock<std::mutex> ul(periodic_mt);
+    while (true) {
+        periodic_cv.wait(ul, [this] { return periodic_running || exiting; });
+        if (exiting)
+            break;
+        ul.unlock();
+        while (periodic_on) {
+            node_mt.lock();
+            simul->run_periodic_callback(index);
+            node_mt.unlock();
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        ul.lock();
+        periodic_running = false;
+        periodic_cv.notify_all();
+    }
+}
+
+template <class Sim>
+void NodeWork<Sim>::launch_recv()
+{
+    std::unique_lock<std::mutex> ul(inbound_mt);
+    if (!is_up() || recv_running)
+        return;
+    recv_on = true;
+    recv_running = true;
+    if (!receive_thread.joinable())
+        receive_thread = std::thread(&NodeWork<Sim>::receive_loop, this);
+    ul.unlock();
+    inbound_cv.notify_all();
+}
+template <class Sim>
+void NodeWork<Sim>::launch_periodic()
+{
+    std::unique_lock<std::mutex> ul(periodic_mt);
+    if (!is_up() || periodic_running)
+        return;
+    periodic_on = true;
+    periodic_running = true;
+    if (!periodic_thread.joinable())
+        periodic_thread = std::thread(&NodeWork<Sim>::periodic_loop, this);
+    ul.unlock();
+    periodic_cv.notify_all();
+}
+
+template <class Sim>
+void NodeWork<Sim>::end_recv()
+{
+    std::unique_lock<std::mutex> ul(inbound_mt);
+    recv_on = false;
+    ul.unlock();
+    inbound_cv.notify_all();
+}
+template <class Sim>
+void NodeWork<Sim>::end_periodic()
+{
+    periodic_on = false;
+}
+template <class Sim>
+void NodeWork<Sim>::wait_recv_parked()
+{
+    std::unique_lock<std::mutex> ul(inbound_mt);
+    inbound_cv.wait(ul, [this] { return !recv_running; });
+}
+template <class Sim>
+void NodeWork<Sim>::wait_periodic_parked()
+{
+    std::unique_lock<std::mutex> ul(periodic_mt);
+    periodic_cv.wait(ul, [this] { return !periodic_running; });
+}
+
+template <class Sim>
+NodeWork<Sim>::~NodeWork()
+{
+    end_periodic();
+    end_recv();
+    wait_periodic_parked();
+    wait_recv_parked();
+
+    exiting = true;
+    {
+        // so that the threads are either waiting and notified or yet to check `exiting`
+        std::lock_guard<std::mutex> lg1(periodic_mt);
+        std::lock_guard<std::mutex> lg2(inbound_mt);
+    }
+    periodic_cv.notify_all();
+    inbound_cv.notify_all();
+    if (periodic_thread.joinable())
+        periodic_thread.join();
+    if (receive_thread.joinable())
+        receive_thread.join();
+}
+
+template <class Sim>
+SendStatus NodeWork<Sim>::receive_packet(Simulation::PacketReceivedInfo&& f)
+{
+    Profiler::Scope ps(profiler, ProfileStage::QUEUE);
+    std::unique_lock<std::mutex> ul(inbound_mt);
+    // only once parked, which happens after `end_recv` with the queue empty
+    if (!recv_running) {
+        simul->packet_dropped_at_queue(/*by_policy*/ false);
+        return SendStatus::DROPPED;
+    }
+    SendStatus s = gate.admit(limit, inbound.size());
+    if (s == SendStatus::DROPPED)
+        simul->packet_dropped_at_queue(/*by_policy*/ true);
+    if (s != SendStatus::SENT)
+        return s;
+    simul->packet_enqueued(f.contains_segment);
+    inbound.push(std::move(f));
+    ul.unlock();
+    inbound_cv.notify_all();
+    return SendStatus::SENT;
+}
+
+template <class Sim>
+size_t NodeWork<Sim>::queue_length()
+{
+    std::lock_guard<std::mutex> lg(inbound_mt);
+    return inbound.size();
+}
+
+template <class Sim>
+size_t NodeWork<Sim>::drop_inbound()
+{
+    std::unique_lock<std::mutex> ul(inbound_mt);
+    std::queue<Simulation::PacketReceivedInfo> q;
+    q.swap(inbound);
+    ul.unlock();
+    size_t n = q.size();
+    for (; !q.empty(); q.pop())
+        simul->packet_processed(q.front().contains_segment);
+    return n;
+}
+
+template <class Sim>
+void ThreadedRuntime<Sim>::add_nodes()
+{
+    for (size_t i = works.size(); i < nodes.size(); ++i) {
+        works.emplace_back(new NodeWork<Sim>(sim, liveness, i, limit, profiler));
+        if (log_enabled)
+            works.back()->logger.open(log_path(i));
+    }
+}
+
+template <class Sim>
+void ThreadedRuntime<Sim>::launch_recv()
+{
+    for (auto const& w : works)
+        w->launch_recv();
+}
+template <class Sim>
+void ThreadedRuntime<Sim>::launch_periodic()
+{
+    for (auto const& w : works)
+        w->launch_periodic();
+}
+template <class Sim>
+void ThreadedRuntime<Sim>::end_recv()
+{
+    for (auto const& w : works) {
+        w->end_recv();
+        w->wait_recv_parked();
+    }
+}
+template <class Sim>
+void ThreadedRuntime<Sim>::end_periodic()
+{
+    for (auto const& w : works)
+        w->end_periodic();
+}
+template <class Sim>
+void ThreadedRuntime<Sim>::wait_recv_parked()
+{
+    for (auto const& w : works)
+        w->wait_recv_parked();
+}
+template <class Sim>
+void ThreadedRuntime<Sim>::wait_periodic_parked()
+{
+    for (auto const& w : works)
+        w->wait_periodic_parked();
+}
+
 #endif // NODE_WORK_H
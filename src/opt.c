@@ -3,11 +3,25 @@
 #include <stdlib.h>
 
 static char const* doc = "layer2simulator - A Layer 2 Network Simulator";
-static char const* args_doc = "NODE_TYPE FILE.netspec FILE.msgs";
+static char const* args_doc = "NODE_TYPE FILE.netspec FILE.msgs\n--sweep MANIFEST";
 static struct argp_option options[] = {
     { "log", 'l', "NODE_LOG_FILE_PREFIX", OPTION_ARG_OPTIONAL, "Emit node-wise logs to file \"{NODE_LOG_FILE_PREFIX}{mac}.log\"\n(default: \"node-\")" },
     { "delay", 'd', "DELAY", 0, "Add delay in ms (50ms if unspecified)" },
     { "grading", 'g', NULL, OPTION_HIDDEN, "Enable autograding view" },
+    { "segment-trace", 's', "FILE", 0, "Dump the path, injection and delivery time of every segment to FILE" },
+    { "profile", 'p', NULL, 0, "Measure the cost of the simulator's core stages using hardware performance counters" },
+    { "trace", 't', "FILE", 0, "Record every send, receive, drop, up/down and delivery event to FILE in binary (see bin/l2trace)" },
+    { "trace-timers", 'T', NULL, 0, "Also record every do_periodic call to the --trace as a timer event" },
+    { "save-snapshot", 'S', "FILE", 0, "Save the simulator state to FILE at the end of the last phase (or of phase --snapshot-phase)" },
+    { "snapshot-phase", 'P', "PHASE", 0, "Phase (counting from 1) after which --save-snapshot saves the state" },
+    { "restore", 'r', "FILE", 0, "Resume from the state saved in FILE, with the same node type and network file" },
+    { "sweep", 'w', "MANIFEST", 0, "Run every line \"NODE_TYPE FILE.netspec FILE.msgs [delay=MS] [workers=N]\" of MANIFEST concurrently and report the results as JSON (no other arguments needed)" },
+    { "jobs", 'j', "JOBS", 0, "Number of runs of --sweep run at a time (default: one per CPU)" },
+    { "queue-capacity", 'q', "PACKETS", 0, "Bound the inbound queue of every node to PACKETS packets (unbounded if unspecified)" },
+    { "queue-policy", 'Q', "POLICY", 0, "What full queues do with the packets that arrive: \"tail-drop\" them, drop them early with \"red\", or refuse them with \"backpressure\"\n(default: \"tail-drop\")" },
+    { "metrics", 'm', "TARGET", 0, "Export live metrics in the Prometheus text format, to clients of the Unix domain socket PATH if TARGET is \"unix:PATH\", otherwise appended to the file TARGET (rolled over to TARGET.1 past 16 MiB)" },
+    { "metrics-interval", 'M', "MS", 0, "Interval in ms at which --metrics are sampled (1000ms if unspecified)" },
+    { "compact", 'c', "WORKERS", OPTION_ARG_OPTIONAL, "Run nodes on WORKERS threads with compact per-node state, for large topologies\n(default: one per CPU)" },
     { 0 }
 };
 
@@ -16,6 +30,21 @@ bool grading_view = false;
 char const* logfile_prefix = "node-";
 char const* args[3] = { 0 };
 size_t delay_ms = 50;
+char const* segment_trace_file = NULL;
+char const* event_trace_file = NULL;
+bool trace_timers = false;
+bool profile_enabled = false;
+char const* save_snapshot_file = NULL;
+size_t snapshot_phase = 0;
+char const* restore_file = NULL;
+char const* sweep_file = NULL;
+size_t nr_jobs = 0;
+size_t queue_capacity = 0;
+char const* queue_policy = "tail-drop";
+char const* metrics_target = NULL;
+size_t metrics_interval_ms = 1000;
+bool compact = false;
+size_t nr_workers = 0;
 
 static error_t parse_opt(int key, char* arg, struct argp_state* state)
 {
@@ -28,6 +57,66 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state)
     case 'g':
         grading_view = true;
         break;
+    case 's':
+        segment_trace_file = arg;
+        break;
+    case 't':
+        event_trace_file = arg;
+        break;
+    case 'T':
+        trace_timers = true;
+        break;
+    case 'p':
+        profile_enabled = true;
+        break;
+    case 'S':
+        save_snapshot_file = arg;
+        break;
+    case 'P': {
+        char* a = NULL;
+        snapshot_phase = strtol(arg, &a, 10);
+        if (*a != '\0' || snapshot_phase == 0)
+            argp_usage(state);
+    } break;
+    case 'r':
+        restore_file = arg;
+        break;
+    case 'w':
+        sweep_file = arg;
+        break;
+    case 'j': {
+        char* a = NULL;
+        nr_jobs = strtol(arg, &a, 10);
+        if (*a != '\0' || nr_jobs == 0)
+            argp_usage(state);
+    } break;
+    case 'q': {
+        char* a = NULL;
+        queue_capacity = strtol(arg, &a, 10);
+        if (*a != '\0' || queue_capacity == 0)
+            argp_usage(state);
+    } break;
+    case 'Q':
+        queue_policy = arg;
+        break;
+    case 'm':
+        metrics_target = arg;
+        break;
+    case 'M': {
+        char* a = NULL;
+        metrics_interval_ms = strtol(arg, &a, 10);
+        if (*a != '\0' || metrics_interval_ms == 0)
+            argp_usage(state);
+    } break;
+    case 'c': {
+        compact = true;
+        if (arg != NULL) {
+            char* a = NULL;
+            nr_workers = strtol(arg, &a, 10);
+            if (*a != '\0' || nr_workers == 0)
+                argp_usage(state);
+        }
+    } break;
     case 'd': {
         char* a = NULL;
         delay_ms = strtol(arg, &a, 10);
@@ -40,7 +129,7 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state)
         args[state->arg_num] = arg;
         break;
     case ARGP_KEY_END:
-        if (state->arg_num < 3)
+        if (state->arg_num < 3 && sweep_file == NULL)
             argp_usage(state);
         break;
     default:
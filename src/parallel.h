@@ -0,0 +1,29 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/*
+ * calls `f(i)` for every i in [0, n) on up to `nr_threads` threads, the caller's included,
+ * which take the next i in turn; `f` must not throw
+ */
+template <class F>
+void parallel_for(size_t n, size_t nr_threads, F const& f)
+{
+    std::atomic<size_t> next = 0;
+    auto work = [&]() {
+        for (size_t i; (i = next++) < n;)
+            f(i);
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < std::min(n, nr_threads); ++t)
+        threads.emplace_back(work);
+    work();
+    for (auto& t : threads)
+        t.join();
+}
+
+#endif // PARALLEL_H
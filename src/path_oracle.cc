@@ -0,0 +1,169 @@
+#include "path_oracle.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <queue>
+
+PathOracle::Tree PathOracle::compute(size_t from) const
+{
+    size_t n = topology.size();
+    Tree t { std::vector<uint64_t>(n, INFTY), std::vector<uint32_t>(n, 0), std::vector<uint32_t>(n, 0), std::vector<uint64_t>(n, 0), 0 };
+    std::vector<bool> visited(n, false);
+    using Entry = std::pair<uint64_t, size_t>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> pq;
+
+    t.distances[from] = 0;
+    t.nr_paths[from] = 1;
+    pq.emplace(0, from);
+
+    while (!pq.empty()) {
+        auto [min_dist, m] = pq.top();
+        pq.pop();
+        if (visited[m] || min_dist != t.distances[m])
+            continue;
+        visited[m] = true;
+        if (!liveness.test(m))
+            continue;
+        for (Topology::Edge const& e : topology.edges(m)) {
+            if (!e.up || visited[e.to])
+                continue;
+            uint64_t d = min_dist + e.distance;
+            if (t.distances[e.to] > d) {
+                t.min_hop_counts[e.to] = t.min_hop_counts[m] + 1;
+                t.max_hop_counts[e.to] = t.max_hop_counts[m] + 1;
+                t.nr_paths[e.to] = t.nr_paths[m];
+                t.distances[e.to] = d;
+                pq.emplace(d, e.to);
+            } else if (t.distances[e.to] == d) {
+                // another shortest path, through m
+                t.min_hop_counts[e.to] = std::min(t.min_hop_counts[e.to], t.min_hop_counts[m] + 1);
+                t.max_hop_counts[e.to] = std::max(t.max_hop_counts[e.to], t.max_hop_counts[m] + 1);
+                t.nr_paths[e.to] = std::min(t.nr_paths[e.to], ~uint64_t(0) - t.nr_paths[m]) + t.nr_paths[m];
+            }
+        }
+    }
+    return t;
+}
+
+std::optional<PathOracle::Path> PathOracle::Tree::path(size_t to) const
+{
+    if (distance(to) == INFTY)
+        return std::nullopt;
+    return Path { min_hop_counts[to], max_hop_counts[to], distances[to], nr_paths[to] };
+}
+
+PathOracle::Tree& PathOracle::insert(size_t from, Tree&& t)
+{
+    size_t max_trees = std::max<size_t>(1, MAX_CACHED_ENTRIES / std::max<size_t>(1, topology.size()));
+    while (trees.size() >= max_trees) {
+        auto lru = std::min_element(trees.begin(), trees.end(), [](auto const& x, auto const& y) { return x.second.last_used < y.second.last_used; });
+        trees.erase(lru);
+    }
+    return trees.emplace(from, std::move(t)).first->second;
+}
+
+std::optional<PathOracle::Path> PathOracle::shortest_path(size_t from, size_t to)
+{
+    return shortest_paths({ { from, to } }, 1).front();
+}
+
+std::vector<std::optional<PathOracle::Path>> PathOracle::shortest_paths(std::vector<std::pair<size_t, size_t>> const& queries, size_t nr_threads)
+{
+    /*
+     * queries are grouped by source, each group being answered from a single tree
+     * that is computed outside the lock if not cached
+     */
+    std::vector<size_t> order(queries.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t x, size_t y) { return queries[x].first < queries[y].first; });
+    std::vector<size_t> group_starts;
+    for (size_t i = 0; i < order.size(); ++i)
+        if (i == 0 || queries[order[i]].first != queries[order[i - 1]].first)
+            group_starts.push_back(i);
+    group_starts.push_back(order.size());
+
+    std::vector<std::optional<Path>> paths(queries.size());
+    parallel_for(group_starts.size() - 1, nr_threads, [&](size_t g) {
+        size_t begin = group_starts[g], end = group_starts[g + 1];
+        size_t from = queries[order[begin]].first;
+        auto answer = [&](Tree& t) {
+            t.last_used = clock++;
+            for (size_t i = begin; i < end; ++i)
+                paths[order[i]] = t.path(queries[order[i]].second);
+        };
+        {
+            std::lock_guard<std::mutex> lk(mt);
+            auto it = trees.find(from);
+            if (it != trees.end()) {
+                stats.nr_cached += end - begin;
+                answer(it->second);
+                return;
+            }
+        }
+        Tree t = compute(from);
+        std::lock_guard<std::mutex> lk(mt);
+        stats.nr_computed++;
+        stats.nr_cached += end - begin - 1;
+        answer(insert(from, std::move(t)));
+    });
+    return paths;
+}
+
+bool PathOracle::matters(Tree const& t, size_t u, size_t v, size_t distance, bool added) const
+{
+    uint64_t du = t.distance(u), dv = t.distance(v);
+    if (du == INFTY)
+        return false;
+    // ties matter too, as they change the number of shortest paths
+    return (added ? du + distance <= dv : du + distance == dv);
+}
+
+template <class Affected>
+void PathOracle::invalidate(Affected affected)
+{
+    for (auto it = trees.begin(); it != trees.end();) {
+        if (affected(it->second)) {
+            it = trees.erase(it);
+            stats.nr_invalidated++;
+        } else
+            ++it;
+    }
+}
+
+void PathOracle::link_removed(size_t a, size_t b, size_t distance)
+{
+    bool up_a = liveness.test(a), up_b = liveness.test(b);
+    invalidate([&](Tree const& t) {
+        return (up_a && matters(t, a, b, distance, false)) || (up_b && matters(t, b, a, distance, false));
+    });
+}
+void PathOracle::link_added(size_t a, size_t b, size_t distance)
+{
+    bool up_a = liveness.test(a), up_b = liveness.test(b);
+    invalidate([&](Tree const& t) {
+        return (up_a && matters(t, a, b, distance, true)) || (up_b && matters(t, b, a, distance, true));
+    });
+}
+void PathOracle::liveness_changing(size_t i, bool up)
+{
+    /*
+     * a node that goes down (up) stops (starts) being crossed, i.e. its links are removed (added) on its side
+     */
+    if (liveness.test(i) == up)
+        return;
+    invalidate([&](Tree const& t) {
+        for (Topology::Edge const& e : topology.edges(i))
+            if (e.up && matters(t, i, e.to, e.distance, up))
+                return true;
+        return false;
+    });
+}
+
+PathOracle::Stats PathOracle::take_stats()
+{
+    Stats s = stats;
+    stats = Stats();
+    return s;
+}
@@ -0,0 +1,96 @@
+#ifndef PATH_ORACLE_H
+#define PATH_ORACLE_H
+
+#include "liveness.h"
+#include "topology.h"
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*
+ * shortest paths from a source to every node, computed with Dijkstra and cached per source
+ * nodes that are down can be reached but are not crossed, nor are links that are down
+ * topology changes must be reported so that only the cached trees they affect are dropped
+ * trees are computed concurrently by `shortest_paths`, nothing else may race with it
+ */
+class PathOracle {
+public:
+    /*
+     * all shortest (minimum distance) paths to a destination, any of which is ideal
+     * `nr_paths` saturates, and may be undercounted across links of distance 0
+     */
+    struct Path {
+        size_t min_hop_count;
+        size_t max_hop_count;
+        size_t distance;
+        uint64_t nr_paths;
+    };
+    struct Stats {
+        size_t nr_computed = 0;
+        size_t nr_cached = 0;
+        size_t nr_invalidated = 0;
+    };
+
+private:
+    static uint64_t constexpr INFTY = ~uint64_t(0);
+    // bounds the memory of the cache to about 24 bytes times this
+    static size_t constexpr MAX_CACHED_ENTRIES = size_t(1) << 24;
+
+    struct Tree {
+        // indexed by node, nodes added since the tree was computed are unreachable
+        std::vector<uint64_t> distances;
+        std::vector<uint32_t> min_hop_counts;
+        std::vector<uint32_t> max_hop_counts;
+        std::vector<uint64_t> nr_paths;
+        uint64_t last_used;
+
+        uint64_t distance(size_t i) const { return i < distances.size() ? distances[i] : INFTY; }
+        std::optional<Path> path(size_t to) const;
+    };
+
+    Topology const& topology;
+    LivenessSet const& liveness;
+    // guards `trees`, `clock` and `stats`
+    std::mutex mt;
+    std::unordered_map<size_t, Tree> trees;
+    uint64_t clock = 0;
+    Stats stats;
+
+    Tree compute(size_t from) const;
+    Tree& insert(size_t from, Tree&& t);
+    /*
+     * whether the expansion of `u` over a link to `v` of `distance` mattered to `t`,
+     * or would matter if added
+     */
+    bool matters(Tree const& t, size_t u, size_t v, size_t distance, bool added) const;
+    template <class Affected>
+    void invalidate(Affected affected);
+
+public:
+    PathOracle(Topology const& topology, LivenessSet const& liveness)
+        : topology(topology), liveness(liveness) { }
+
+    std::optional<Path> shortest_path(size_t from, size_t to);
+    /*
+     * answers (from, to) queries in order, with the trees of distinct sources
+     * looked up, or computed, on up to `nr_threads` threads
+     */
+    std::vector<std::optional<Path>> shortest_paths(std::vector<std::pair<size_t, size_t>> const& queries, size_t nr_threads);
+
+    /*
+     * to be called before the topology (or liveness) is changed
+     */
+    void link_removed(size_t a, size_t b, size_t distance);
+    void link_added(size_t a, size_t b, size_t distance);
+    void liveness_changing(size_t i, bool up);
+
+    size_t nr_cached_trees() const { return trees.size(); }
+    // since the last call
+    Stats take_stats();
+};
+
+#endif // PATH_ORACLE_H
@@ -0,0 +1,241 @@
+#include "profiler.h"
+
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
+
+static char const* stage_name(ProfileStage s)
+{
+    switch (s) {
+    case ProfileStage::PARSE:
+        return "parse";
+    case ProfileStage::IDEAL_PATH:
+        return "ideal-path";
+    case ProfileStage::SEND_PACKET:
+        return "send_packet";
+    case ProfileStage::QUEUE:
+        return "queue";
+    case ProfileStage::RECEIVE_CALLBACK:
+        return "receive_packet";
+    case ProfileStage::PERIODIC_CALLBACK:
+        return "do_periodic";
+    }
+    __builtin_unreachable();
+}
+
+namespace {
+/*
+ * one counter group per thread, since perf counters count for the thread that opened them
+ */
+struct PerfGroup {
+    int leader = -1;
+    int fds[Profiler::NR_COUNTERS] = { -1, -1, -1, -1 };
+    bool tried = false;
+
+    // all counters are closed again unless all could be opened
+    bool open();
+    void close_all();
+    ~PerfGroup();
+};
+
+#ifdef __linux__
+static int perf_event_open(uint64_t config, int group_fd)
+{
+    perf_event_attr attr {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = (group_fd == -1);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+bool PerfGroup::open()
+{
+    tried = true;
+    uint64_t constexpr configs[Profiler::NR_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    for (size_t i = 0; i < Profiler::NR_COUNTERS; ++i) {
+        fds[i] = perf_event_open(configs[i], leader);
+        if (fds[i] == -1) {
+            close_all();
+            return false;
+        }
+        if (i == 0)
+            leader = fds[0];
+    }
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+void PerfGroup::close_all()
+{
+    for (int& fd : fds) {
+        if (fd != -1)
+            close(fd);
+        fd = -1;
+    }
+    leader = -1;
+}
+#else
+bool PerfGroup::open()
+{
+    tried = true;
+    return false;
+}
+void PerfGroup::close_all() { }
+#endif
+PerfGroup::~PerfGroup()
+{
+    close_all();
+}
+}
+
+static thread_local PerfGroup perf_group;
+static thread_local Profiler::Scope* current_scope = nullptr;
+
+Profiler::Profiler()
+    : nr_threads_timed(0)
+{
+    hw_counters = perf_group.open();
+}
+
+bool Profiler::read(Counters& c)
+{
+    c.fill(0);
+#ifdef __linux__
+    if (hw_counters) {
+        if (!perf_group.tried && !perf_group.open())
+            nr_threads_timed++;
+        uint64_t buf[1 + NR_COUNTERS];
+        if (perf_group.leader != -1 && ::read(perf_group.leader, buf, sizeof(buf)) == sizeof(buf)) {
+            for (size_t i = 0; i < NR_COUNTERS; ++i)
+                c[i] = buf[1 + i];
+            return true;
+        }
+    }
+#endif
+    /*
+     * fallback: TSC ticks (or nanoseconds) and nanoseconds
+     */
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#if defined(__x86_64__) || defined(__i386__)
+    c[0] = __rdtsc();
+#else
+    c[0] = ns;
+#endif
+    c[1] = ns;
+    return false;
+}
+
+Profiler::Scope::Scope(Profiler* p, ProfileStage stage)
+    : p(p), stage(stage), parent(p == nullptr ? nullptr : current_scope), counted(false), children {}
+{
+    if (p == nullptr)
+        return;
+    current_scope = this;
+    counted = p->read(start);
+}
+Profiler::Scope::~Scope()
+{
+    if (p == nullptr)
+        return;
+    Counters end;
+    bool end_counted = p->read(end);
+    current_scope = parent;
+    // the counters failed to be read in between, which cannot be made sense of
+    if (end_counted != counted)
+        return;
+
+    StageTotals& t = (counted ? p->counted : p->timed)[static_cast<size_t>(stage)];
+    t.calls.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < NR_COUNTERS; ++i) {
+        uint64_t d = (end[i] >= start[i] ? end[i] - start[i] : 0);
+        t.inclusive[i].fetch_add(d, std::memory_order_relaxed);
+        t.self[i].fetch_add(d >= children[i] ? d - children[i] : 0, std::memory_order_relaxed);
+        if (parent != nullptr)
+            parent->children[i] += d;
+    }
+}
+
+std::string Profiler::report(size_t nr_packets) const
+{
+    char const* timer =
+#if defined(__x86_64__) || defined(__i386__)
+        "rdtsc";
+#else
+        "steady_clock";
+#endif
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    if (hw_counters)
+        ss << "Profile (hardware counters; self excludes nested stages, \"/pkt\" is per packet transmitted):";
+    else
+        ss << "Profile (hardware counters unavailable, timing with " << timer << "; self excludes nested stages, \"/pkt\" is per packet transmitted):";
+
+    auto per_packet = [nr_packets](uint64_t v) { return nr_packets == 0 ? 0.0 : static_cast<double>(v) / nr_packets; };
+    for (size_t s = 0; s < NR_STAGES; ++s) {
+        StageTotals const& t = counted[s];
+        uint64_t calls = t.calls;
+        if (calls == 0)
+            continue;
+        auto per_call = [calls](uint64_t v) { return static_cast<double>(v) / calls; };
+        uint64_t cycles = t.self[0], instructions = t.self[1];
+        ss << "\n\t" << std::left << std::setw(15) << stage_name(static_cast<ProfileStage>(s)) << std::right
+           << " calls = " << std::setw(9) << calls
+           << "  cycles/call = " << std::setw(9) << per_call(cycles)
+           << " (incl " << per_call(t.inclusive[0]) << ")"
+           << "  IPC = " << std::setprecision(2) << (cycles == 0 ? 0.0 : static_cast<double>(instructions) / cycles) << std::setprecision(1)
+           << "  cache-misses/call = " << per_call(t.self[2])
+           << "  branch-misses/call = " << per_call(t.self[3])
+           << "  cycles/pkt = " << per_packet(cycles);
+    }
+
+    if (hw_counters && nr_threads_timed > 0)
+        ss << "\n\thardware counters could not be opened on " << nr_threads_timed
+           << " thread(s) (e.g. too many open files), their stages are timed with " << timer << ":";
+    for (size_t s = 0; s < NR_STAGES; ++s) {
+        StageTotals const& t = timed[s];
+        uint64_t calls = t.calls;
+        if (calls == 0)
+            continue;
+        auto per_call = [calls](uint64_t v) { return static_cast<double>(v) / calls; };
+        ss << "\n\t" << std::left << std::setw(15) << stage_name(static_cast<ProfileStage>(s)) << std::right
+           << " calls = " << std::setw(9) << calls
+           << "  ticks/call = " << std::setw(9) << per_call(t.self[0])
+           << " (incl " << per_call(t.inclusive[0]) << ")"
+           << "  ns/call = " << per_call(t.self[1])
+           << "  ticks/pkt = " << per_packet(t.self[0])
+           << "  ns/pkt = " << per_packet(t.self[1]);
+    }
+    return ss.str();
+}
+
+void Profiler::reset()
+{
+    for (auto* totals : { &counted, &timed }) {
+        for (auto& t : *totals) {
+            t.calls = 0;
+            for (size_t i = 0; i < NR_COUNTERS; ++i) {
+                t.inclusive[i] = 0;
+                t.self[i] = 0;
+            }
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+enum class ProfileStage : uint8_t {
+    PARSE,
+    IDEAL_PATH,
+    SEND_PACKET,
+    QUEUE,
+    RECEIVE_CALLBACK,
+    PERIODIC_CALLBACK,
+};
+
+/*
+ * measures the simulator's core stages using hardware performance counters
+ * (cycles, instructions, cache misses and branch misses) read via perf_event_open,
+ * falling back to the TSC (or steady_clock) where those are unavailable, and
+ * on the threads that could not open theirs (e.g. for want of file descriptors)
+ */
+class Profiler {
+public:
+    static size_t constexpr NR_STAGES = static_cast<size_t>(ProfileStage::PERIODIC_CALLBACK) + 1;
+    static size_t constexpr NR_COUNTERS = 4;
+    using Counters = std::array<uint64_t, NR_COUNTERS>;
+
+private:
+    struct StageTotals {
+        std::atomic<uint64_t> calls = 0;
+        std::array<std::atomic<uint64_t>, NR_COUNTERS> inclusive = {};
+        std::array<std::atomic<uint64_t>, NR_COUNTERS> self = {};
+    };
+    // of the stages measured with hardware counters, and of those timed
+    std::array<StageTotals, NR_STAGES> counted;
+    std::array<StageTotals, NR_STAGES> timed;
+
+    bool hw_counters;
+    // threads that fell back to timing although `hw_counters`
+    std::atomic<size_t> nr_threads_timed;
+
+    // returns whether `c` was read from hardware counters, otherwise it holds timings
+    bool read(Counters& c);
+
+public:
+    Profiler();
+
+    /*
+     * RAII measurement of one stage, a no-op for a null `Profiler`
+     * time spent in nested scopes is excluded from the "self" cost of the enclosing one
+     */
+    class Scope {
+    private:
+        Profiler* const p;
+        ProfileStage const stage;
+        Scope* const parent;
+        bool counted;
+        Counters start;
+        Counters children;
+
+    public:
+        Scope(Profiler* p, ProfileStage stage);
+        ~Scope();
+    };
+
+    bool uses_hw_counters() const { return hw_counters; }
+    std::string report(size_t nr_packets) const;
+    void reset();
+};
+
+#endif // PROFILER_H
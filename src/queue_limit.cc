@@ -0,0 +1,34 @@
+#include "queue_limit.h"
+
+double QueueGate::uniform()
+{
+    // splitmix64
+    uint64_t z = (rng += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    z ^= z >> 31;
+    return (z >> 11) * 0x1p-53;
+}
+
+SendStatus QueueGate::admit(QueueLimit const& limit, size_t length)
+{
+    if (limit.capacity == 0)
+        return SendStatus::SENT;
+    switch (limit.policy) {
+    case QueuePolicy::TAIL_DROP:
+        return (length < limit.capacity ? SendStatus::SENT : SendStatus::DROPPED);
+    case QueuePolicy::BACKPRESSURE:
+        return (length < limit.capacity ? SendStatus::SENT : SendStatus::WOULD_BLOCK);
+    case QueuePolicy::RED:
+        break;
+    }
+
+    avg_length += RED_WEIGHT * (double(length) - avg_length);
+    double min_th = limit.capacity / 4.0, max_th = limit.capacity * 3 / 4.0;
+    if (length >= limit.capacity || avg_length >= max_th)
+        return SendStatus::DROPPED;
+    if (avg_length < min_th)
+        return SendStatus::SENT;
+    double p = RED_MAX_P * (avg_length - min_th) / (max_th - min_th);
+    return (uniform() < p ? SendStatus::DROPPED : SendStatus::SENT);
+}
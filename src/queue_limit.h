@@ -0,0 +1,48 @@
+#ifndef QUEUE_LIMIT_H
+#define QUEUE_LIMIT_H
+
+#include "node.h"
+
+#include <cstddef>
+#include <cstdint>
+
+enum class QueuePolicy {
+    TAIL_DROP,
+    RED,
+    BACKPRESSURE,
+};
+
+/*
+ * bound on the inbound queue of every node (0 for none), past which
+ *  - `TAIL_DROP` drops the packets that arrive
+ *  - `RED` drops them, and already drops some of them as the queue's average length
+ *    grows past a quarter of `capacity` (random early detection)
+ *  - `BACKPRESSURE` refuses them, for their senders to retry
+ */
+struct QueueLimit {
+    size_t capacity = 0;
+    QueuePolicy policy = QueuePolicy::TAIL_DROP;
+};
+
+/*
+ * admission to a single inbound queue, to be called under the queue's lock
+ */
+class QueueGate {
+private:
+    // of the newest length in the average
+    static double constexpr RED_WEIGHT = 0.125;
+    // drop probability at three quarters of the capacity, past which all are dropped
+    static double constexpr RED_MAX_P = 0.1;
+    double avg_length;
+    uint64_t rng;
+    double uniform();
+
+public:
+    explicit QueueGate(size_t index)
+        : avg_length(0), rng(index) { }
+
+    // `length` is that of the queue without the packet
+    SendStatus admit(QueueLimit const& limit, size_t length);
+};
+
+#endif // QUEUE_LIMIT_H
@@ -1,253 +1,645 @@
-#include "node_work.h"
+#include "node_runtime.h"
+#include "parallel.h"
 #include "simulation.h"
 
-#include <cassert>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <iomanip>
 #include <iostream>
 #include <limits>
+#include <queue>
+#include <random>
 #include <sstream>
 #include <stdexcept>
 #include <thread>
-#include <unordered_map>
-#include <unordered_set>
 
-std::optional<std::pair<size_t, size_t>> Simulation::hop_count_with_min_distance(MACAddress m1, MACAddress m2) const
+#include <sys/resource.h>
+
+static auto constexpr QUIESCENCE_POLL_INTERVAL = std::chrono::microseconds(100);
+static auto constexpr MIN_SETTLE_TIME = std::chrono::milliseconds(1);
+
+std::vector<std::optional<PathOracle::Path>> Simulation::ideal_paths(std::vector<std::pair<size_t, size_t>> const& queries, size_t nr_threads)
+{
+    Profiler::Scope ps(profiler, ProfileStage::IDEAL_PATH);
+    return oracle.shortest_paths(queries, nr_threads);
+}
+
+static bool is_topology_change(std::string const& type)
+{
+    return type == "UP" || type == "DOWN" || type == "LINK_UP" || type == "LINK_DOWN" || type == "COST" || type == "ADD_NODE" || type == "ADD_EDGE";
+}
+
+bool Simulation::apply_topology_change(std::string const& line)
+{
+    std::stringstream ss(line);
+    std::string type;
+    ss >> type;
+    if (!is_topology_change(type))
+        return false;
+
+    auto index_of = [this](MACAddress mac) {
+        auto index = mac_to_index.find(mac);
+        if (!index.has_value())
+            throw std::invalid_argument("Bad message file: Invalid node '" + std::to_string(mac) + "', not a MAC address of a node");
+        return index.value();
+    };
+    auto malformed = [&] { return std::invalid_argument("Bad message file: Malformed " + type + " line '" + line + "'"); };
+
+    if (type == "UP" || type == "DOWN") {
+        bool is_up = (type == "UP");
+        MACAddress mac;
+        while (ss >> mac) {
+            size_t index = index_of(mac);
+            log(LogLevel::INFO, (is_up ? "Bringing up (mac:" : "Bringing down (mac:") + std::to_string(mac) + ")");
+            oracle.liveness_changing(index, is_up);
+            liveness.set(index, is_up);
+            if (!is_up)
+                packets_dropped += runtime->drop_inbound(index);
+            if (tracer != nullptr)
+                tracer->record(is_up ? EventType::UP : EventType::DOWN, mac);
+        }
+    } else if (type == "ADD_NODE") {
+        MACAddress mac;
+        IPAddress ip;
+        ss >> mac >> ip;
+        if (!ss)
+            throw malformed();
+        size_t index = nodes->size();
+        if (index > AddressIndex::MAX_INDEX)
+            throw std::invalid_argument("Bad message file: Too many nodes");
+        if (mac_to_index.find(mac).has_value())
+            throw std::invalid_argument("Bad message file: MAC '" + std::to_string(mac) + "' repeated");
+        if (ip_to_index.find(ip).has_value())
+            throw std::invalid_argument("Bad message file: IP '" + std::to_string(ip) + "' repeated");
+        log(LogLevel::INFO, "Adding (mac:" + std::to_string(mac) + ") with (ip:" + std::to_string(ip) + ")");
+        mac_to_index.insert(mac, index);
+        ip_to_index.insert(ip, index);
+        nodes->emplace(this, mac, ip);
+        topology.add_node();
+        liveness.resize(index + 1);
+        runtime->add_nodes();
+        if (tracer != nullptr)
+            tracer->record(EventType::ADD_NODE, mac);
+    } else {
+        MACAddress m1, m2;
+        size_t distance = 0;
+        ss >> m1 >> m2;
+        if (type == "COST" || type == "ADD_EDGE")
+            ss >> distance;
+        if (!ss || distance > Topology::MAX_DISTANCE)
+            throw malformed();
+        size_t a = index_of(m1), b = index_of(m2);
+        std::string link = "(mac:" + std::to_string(m1) + ")-(mac:" + std::to_string(m2) + ")";
+        Topology::Edge const* e = topology.find(a, b);
+        EventType event;
+
+        if (type == "ADD_EDGE") {
+            if (e != nullptr)
+                throw std::invalid_argument("Bad message file: Edge between " + link + " repeated");
+            log(LogLevel::INFO, "Adding link " + link + " with distance " + std::to_string(distance));
+            oracle.link_added(a, b, distance);
+            topology.add_link(a, b, distance);
+            event = EventType::ADD_EDGE;
+        } else if (e == nullptr)
+            throw std::invalid_argument("Bad message file: No edge between " + link);
+        else if (type == "COST") {
+            log(LogLevel::INFO, "Changing distance of link " + link + " from " + std::to_string(e->distance) + " to " + std::to_string(distance));
+            if (e->up) {
+                oracle.link_removed(a, b, e->distance);
+                oracle.link_added(a, b, distance);
+            }
+            topology.set_distance(a, b, distance);
+            event = EventType::COST;
+        } else {
+            bool up = (type == "LINK_UP");
+            log(LogLevel::INFO, (up ? "Bringing up link " : "Bringing down link ") + link);
+            distance = e->distance;
+            if (e->up && !up)
+                oracle.link_removed(a, b, distance);
+            else if (!e->up && up)
+                oracle.link_added(a, b, distance);
+            topology.set_up(a, b, up);
+            event = (up ? EventType::LINK_UP : EventType::LINK_DOWN);
+        }
+        if (tracer != nullptr)
+            tracer->record(event, m1, m2, distance);
+    }
+    return true;
+}
+
+Simulation::TrafficSpec Simulation::parse_traffic(std::string const& line)
+{
+    std::stringstream ss(line);
+    TrafficSpec t {};
+    ss >> t.type;
+    MACAddress src_mac;
+    if (t.type == "MSG") {
+        t.count = 1;
+        std::string next;
+        ss >> next;
+        if (next == "REPE") {
+            ss >> t.count;
+            ss >> src_mac >> t.dest_ip;
+        } else {
+            src_mac = std::stoi(next);
+            ss >> t.dest_ip;
+        }
+        std::getline(ss, t.segment);
+    } else {
+        size_t duration_ms;
+        t.burst_len = 1;
+        ss >> src_mac >> t.dest_ip >> t.rate >> duration_ms >> t.size;
+        if (t.type == "BURST")
+            ss >> t.burst_len;
+        if (!ss || t.rate <= 0 || t.burst_len == 0)
+            throw std::invalid_argument("Bad message file: Malformed " + t.type + " line '" + line + "'");
+        t.duration = std::chrono::milliseconds(duration_ms);
+        t.flow = nr_flows_generated++;
+    }
+
+    auto src = mac_to_index.find(src_mac);
+    if (!src.has_value())
+        throw std::invalid_argument("Bad message file: Invalid MAC '" + std::to_string(src_mac) + "', not a MAC address of a node");
+    t.src = src.value();
+    if (!liveness.test(t.src)) {
+        log(LogLevel::WARNING, "Node (mac:" + std::to_string(src_mac) + ") is down and cannot send segments");
+        t.disregard = true;
+    }
+
+    auto dest = ip_to_index.find(t.dest_ip);
+    if (!dest.has_value())
+        throw std::invalid_argument("Bad message file: Invalid IP '" + std::to_string(t.dest_ip) + "', not an IP address of a node");
+    t.dest = dest.value();
+    MACAddress dest_mac = (*nodes)[t.dest]->mac;
+    if (!liveness.test(t.dest)) {
+        log(LogLevel::WARNING, "Node (mac:" + std::to_string(dest_mac) + ") is down and cannot receive segments");
+        t.disregard = true;
+    }
+
+    if (src_mac == dest_mac)
+        throw std::invalid_argument("Bad message file: " + t.type + " with identical source and destination");
+    return t;
+}
+
+std::vector<Simulation::SegmentToSendInfo> Simulation::traffic_payloads(TrafficSpec const& t) const
 {
     /*
-     * computed using Dijkstra
+     * MSG REPE contents are "{segment}#{i}", CBR/POISSON/BURST ones "{type}-{flow}#{i}"
+     * padded to `size` bytes, each with its offset from the start of injection
      */
-    struct Info {
-        MACAddress m;
-        size_t hop_count;
-        size_t distance;
-        bool operator<(Info const& i)
-        {
-            return distance < i.distance;
-        }
-        bool operator==(Info const& i)
-        {
-            return m == i.m && hop_count == i.hop_count && distance == i.distance;
+    std::vector<SegmentToSendInfo> batch;
+    auto add = [&](std::string const& segment, Clock::duration at) {
+        batch.emplace_back(t.dest_ip, std::vector<uint8_t>(segment.begin(), segment.end()), 0, at);
+    };
+
+    if (t.type == "MSG") {
+        if (t.count == 1)
+            add(t.segment, Clock::duration::zero());
+        else {
+            batch.reserve(t.count);
+            for (size_t i = 0; i < t.count; ++i)
+                add(t.segment + "#" + std::to_string(i), Clock::duration::zero());
         }
+        return batch;
+    }
+
+    std::string prefix = t.type + "-" + std::to_string(t.flow) + "#";
+    auto add_flow = [&](double at) {
+        std::string segment = prefix + std::to_string(batch.size());
+        if (segment.size() < t.size)
+            segment.append(t.size - segment.size(), '.');
+        add(segment, std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(at)));
     };
+    double end = std::chrono::duration<double>(t.duration).count();
+    if (t.type == "CBR") {
+        for (size_t i = 0; i / t.rate < end; ++i)
+            add_flow(i / t.rate);
+    } else if (t.type == "POISSON") {
+        std::mt19937_64 rng(t.flow);
+        std::exponential_distribution<double> gap(t.rate);
+        for (double at = gap(rng); at < end; at += gap(rng))
+            add_flow(at);
+    } else if (t.type == "BURST") {
+        double period = t.burst_len / t.rate;
+        for (size_t i = 0; i * period < end; ++i)
+            for (size_t j = 0; j < t.burst_len; ++j)
+                add_flow(i * period);
+    }
+    return batch;
+}
+
+Simulation::TrafficTotals Simulation::prepare_traffic(std::vector<TrafficSpec> const& traffic)
+{
+    std::vector<std::pair<size_t, size_t>> queries;
+    std::vector<size_t> query_of(traffic.size(), SIZE_MAX);
+    for (size_t i = 0; i < traffic.size(); ++i)
+        if (!traffic[i].disregard) {
+            query_of[i] = queries.size();
+            queries.emplace_back(traffic[i].src, traffic[i].dest);
+        }
+    /*
+     * the setup threads are split between the two, which are run one after
+     * the other if there is a single one
+     */
+    size_t nr_threads = nr_setup_threads;
+    size_t nr_path_threads = std::max<size_t>(1, nr_threads / 2);
+    size_t nr_payload_threads = std::max<size_t>(1, nr_threads - nr_path_threads);
+    auto ideals_future = std::async(nr_threads > 1 ? std::launch::async : std::launch::deferred, [&]() { return ideal_paths(queries, nr_path_threads); });
+
+    std::vector<std::vector<SegmentToSendInfo>> payloads(traffic.size());
+    parallel_for(traffic.size(), nr_payload_threads, [&](size_t i) { payloads[i] = traffic_payloads(traffic[i]); });
+    auto ideals = ideals_future.get();
+
+    TrafficTotals totals;
+    for (size_t i = 0; i < traffic.size(); ++i) {
+        TrafficSpec const& t = traffic[i];
+        MACAddress src_mac = (*nodes)[t.src]->mac;
+        MACAddress dest_mac = (*nodes)[t.dest]->mac;
+        size_t count = payloads[i].size();
+
+        std::optional<PathOracle::Path> ideal;
+        if (!t.disregard) {
+            ideal = ideals[query_of[i]];
+            if (ideal.has_value()) {
+                totals.ideal_packets_transmitted += count * ideal->min_hop_count;
+                totals.max_ideal_packets_transmitted += count * ideal->max_hop_count;
+                totals.ideal_packets_distance += count * ideal->distance;
+                if (ideal->nr_paths > 1)
+                    totals.nr_multipath_segments += count;
+            } else
+                log(LogLevel::WARNING, "Graph is disconnected, (ip:" + std::to_string(t.dest_ip) + ") is unreachable from (mac:" + std::to_string(src_mac) + ")");
+        }
 
-    size_t constexpr INFTY = std::numeric_limits<size_t>::max();
-
-    std::unordered_map<MACAddress, size_t> min_distances;
-    std::unordered_map<MACAddress, size_t> min_distance_counts;
-    std::unordered_map<MACAddress, size_t> hop_counts;
-    std::unordered_set<MACAddress> unvisited;
-    for (auto r : nodes) {
-        min_distances[r.first] = INFTY;
-        min_distance_counts[r.first] = 0;
-        hop_counts[r.first] = INFTY;
-        unvisited.insert(r.first);
+        totals.nr_segments_to_be_delivered += count;
+        bool src_up = liveness.test(t.src);
+        for (auto& f : payloads[i]) {
+            f.segment_id = segments.size();
+            segment_ids[{ dest_mac, std::string(f.segment.begin(), f.segment.end()) }] = segments.size();
+            segments.emplace_back(src_mac, dest_mac, ideal);
+            if (src_up)
+                outbound.emplace_back(t.src, std::move(f));
+        }
+        if (ideal.has_value())
+            nr_segments_expected += count;
     }
-    min_distances[m1] = 0;
-    min_distance_counts[m1] = 1;
-    hop_counts[m1] = 0;
-
-    while (true) {
-        size_t min_dist = INFTY;
-        MACAddress m;
-        for (auto j : unvisited) {
-            if (min_distances[j] < min_dist) {
-                min_dist = min_distances[j];
-                m = j;
-            }
+    return totals;
+}
+
+Simulation::Clock::duration Simulation::inject_segments()
+{
+    std::vector<std::pair<size_t, SegmentToSendInfo>> schedule;
+    schedule.swap(outbound);
+    std::stable_sort(schedule.begin(), schedule.end(), [](auto const& a, auto const& b) { return a.second.inject_at < b.second.inject_at; });
+
+    Clock::time_point start = Clock::now();
+    for (auto const& s : schedule) {
+        Clock::time_point t = start + s.second.inject_at;
+        if (t > Clock::now())
+            std::this_thread::sleep_until(t);
+        segments[s.second.segment_id].injected_at = Clock::now();
+        runtime->send_segment(s.first, s.second);
+    }
+    return (schedule.empty() ? Clock::duration::zero() : schedule.back().second.inject_at);
+}
+
+bool Simulation::wait_for(std::function<bool()> const& done) const
+{
+    /*
+     * `delay_ms` is only an upper bound, we move on as soon as `done` holds
+     */
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(delay_ms);
+    while (!done()) {
+        if (Clock::now() >= deadline)
+            return false;
+        std::this_thread::sleep_for(QUIESCENCE_POLL_INTERVAL);
+    }
+    return true;
+}
+
+std::function<bool()> Simulation::network_quiet() const
+{
+    /*
+     * quiet once no packet has been in flight, or sent, for a while
+     * (nodes that send periodically never become quiet)
+     */
+    Clock::duration settle = std::max<Clock::duration>(MIN_SETTLE_TIME, std::chrono::milliseconds(delay_ms) / 10);
+    return [this, settle, last_count = total_packets_transmitted.load(), since = Clock::now()]() mutable {
+        Clock::time_point now = Clock::now();
+        size_t count = total_packets_transmitted;
+        if (count != last_count || packets_in_flight > 0) {
+            last_count = count;
+            since = now;
+            return false;
         }
-        if (min_dist == INFTY)
-            break;
-        if (m == m2)
-            break;
-        unvisited.erase(m);
-        if (!nodes.at(m)->is_up)
+        return now - since >= settle;
+    };
+}
+
+Simulation::Convergence Simulation::convergence() const
+{
+    /*
+     * a flow (source, destination) has converged once one of its segments is
+     * delivered along a shortest path; the phase has converged once all its flows have
+     */
+    std::map<std::pair<MACAddress, MACAddress>, std::optional<Clock::time_point>> flows;
+    for (auto const& r : segments) {
+        if (!r.ideal.has_value())
             continue;
-        for (auto r : adj.at(m)) {
-            if (unvisited.count(r.first) > 0) {
-                if (min_distances[r.first] > min_dist + r.second) {
-                    hop_counts[r.first] = hop_counts[m] + 1;
-                    min_distances[r.first] = min_dist + r.second;
-                    min_distance_counts[r.first] = 1;
-                } else if (min_distances[r.first] == min_dist + r.second)
-                    min_distance_counts[r.first]++;
-            }
-        }
+        auto& f = flows[{ r.src_mac, r.dest_mac }];
+        if (r.optimal_delivery_at.has_value() && (!f.has_value() || r.optimal_delivery_at.value() < f.value()))
+            f = r.optimal_delivery_at;
     }
 
-    if (min_distance_counts[m2] > 1) {
-        std::cout << "Multiple min distance paths found between " + std::to_string(m1) + " and " + std::to_string(m2) << '\n'
-                  << std::flush;
-        assert(false);
+    Convergence c { flows.size(), 0, Clock::duration::zero() };
+    for (auto const& f : flows) {
+        if (!f.second.has_value())
+            c.nr_unconverged_flows++;
+        else if (f.second.value() - topology_changed_at > c.time)
+            c.time = f.second.value() - topology_changed_at;
     }
+    return c;
+}
 
-    if (min_distances[m2] == INFTY) {
-        /*
-         * graph is disconnected
-         */
-        return std::optional<std::pair<size_t, size_t>>();
-    } else
-        return std::pair<size_t, size_t> { hop_counts[m2], min_distances[m2] };
+static double peak_rss_mib()
+{
+    rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        return 0;
+    // in KiB on Linux
+    return ru.ru_maxrss / 1024.0;
+}
+
+static double percentile(std::vector<double> const& sorted, double p)
+{
+    /*
+     * nearest-rank
+     */
+    size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+std::string Simulation::latency_report() const
+{
+    struct FlowSamples {
+        size_t nr_segments = 0;
+        std::vector<double> latencies_ms;
+        std::vector<double> stretches;
+    };
+    std::map<std::pair<MACAddress, MACAddress>, FlowSamples> flows;
+    for (auto const& r : segments) {
+        if (!r.injected_at.has_value())
+            continue;
+        FlowSamples& f = flows[{ r.src_mac, r.dest_mac }];
+        f.nr_segments++;
+        if (!r.delivered_at.has_value())
+            continue;
+        f.latencies_ms.push_back(std::chrono::duration<double, std::milli>(r.delivered_at.value() - r.injected_at.value()).count());
+        if (r.delivered_distance.has_value() && r.ideal.has_value() && r.ideal->distance > 0)
+            f.stretches.push_back(static_cast<double>(r.delivered_distance.value()) / r.ideal->distance);
+    }
+
+    std::stringstream ss;
+    ss << "Latency (ms) and path stretch by flow:" << std::fixed << std::setprecision(3);
+    for (auto& i : flows) {
+        FlowSamples& f = i.second;
+        ss << "\n\t(mac:" << i.first.first << ") -> (mac:" << i.first.second << ") delivered "
+           << f.latencies_ms.size() << "/" << f.nr_segments;
+        if (!f.latencies_ms.empty()) {
+            std::sort(f.latencies_ms.begin(), f.latencies_ms.end());
+            ss << "  latency p50 = " << percentile(f.latencies_ms, 0.5)
+               << " p90 = " << percentile(f.latencies_ms, 0.9)
+               << " p99 = " << percentile(f.latencies_ms, 0.99)
+               << " max = " << f.latencies_ms.back();
+        }
+        if (!f.stretches.empty()) {
+            std::sort(f.stretches.begin(), f.stretches.end());
+            ss << "  stretch p50 = " << percentile(f.stretches, 0.5)
+               << " p90 = " << percentile(f.stretches, 0.9)
+               << " p99 = " << percentile(f.stretches, 0.99)
+               << " max = " << f.stretches.back();
+        }
+    }
+    return ss.str();
+}
+
+void Simulation::dump_segment_traces() const
+{
+    /*
+     * one line per segment:
+     *  phase id src_mac dest_mac injected_us delivered_us distance ideal_distance path
+     * times are relative to the start of the run, -1 stands for "none"
+     * path is the comma separated list of MACs the first delivered copy visited
+     */
+    auto us = [this](std::optional<Clock::time_point> const& t) -> long long {
+        if (!t.has_value())
+            return -1;
+        return std::chrono::duration_cast<std::chrono::microseconds>(t.value() - run_started_at).count();
+    };
+    std::ostream& out = *segment_trace_out;
+    for (size_t id = 0; id < segments.size(); ++id) {
+        SegmentRecord const& r = segments[id];
+        out << phase << ' ' << id << ' ' << r.src_mac << ' ' << r.dest_mac << ' '
+            << us(r.injected_at) << ' ' << us(r.delivered_at) << ' ';
+        if (r.delivered_distance.has_value())
+            out << r.delivered_distance.value() << ' ';
+        else
+            out << "-1 ";
+        if (r.ideal.has_value())
+            out << r.ideal->distance << ' ';
+        else
+            out << "-1 ";
+        if (!r.delivered_path.empty()) {
+            auto const& path = r.delivered_path;
+            for (size_t i = 0; i < path.size(); ++i)
+                out << (i == 0 ? "" : ",") << path[i];
+        } else
+            out << '-';
+        out << '\n';
+    }
+    out << std::flush;
 }
 
 void Simulation::run(std::istream& msgfile)
 {
+    run_started_at = Clock::now();
+    // the first phase converges from its first injection
+    bool topology_change_pending = true;
+
     std::string line;
-    bool keep_going = (std::getline(msgfile, line) ? true : false);
+    bool keep_going;
+    if (resume_at.has_value()) {
+        msgfile.seekg(resume_at->first);
+        line = resume_at->second;
+        keep_going = true;
+    } else
+        keep_going = (std::getline(msgfile, line) ? true : false);
     while (keep_going) {
-        std::cout << std::string(50, '=') << '\n';
+        *out << std::string(50, '=') << '\n';
 
-        packets_transmitted = 0;
-        packets_distance = 0;
-        total_packets_transmitted = 0;
-        total_packets_distance = 0;
-        nr_segments_wrongly_delivered = 0;
+        reset_counters();
+        nr_routing_loops = 0;
+        nr_segments_delivered = 0;
+        nr_segments_expected = 0;
+        if (tracer != nullptr) {
+            tracer->phase = phase;
+            tracer->record(EventType::PHASE, 0);
+        }
 
-        size_t ideal_packets_transmitted = 0;
-        size_t ideal_packets_distance = 0;
-        size_t nr_segments_to_be_delivered = 0;
+        TrafficTotals totals;
 
-        for (auto g : nodes)
-            g.second->launch_recv();
-        for (auto g : nodes)
-            g.second->launch_periodic();
+        runtime->launch_recv();
+        runtime->launch_periodic();
+        Clock::time_point periodic_launched_at = Clock::now();
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+        wait_for(network_quiet());
 
+        /*
+         * the lines of the phase are parsed first, their segments being generated
+         * and their ideal paths computed afterwards, all at once
+         */
+        std::vector<TrafficSpec> traffic;
         do {
+            Profiler::Scope ps(profiler, ProfileStage::PARSE);
             std::stringstream ss(line);
             std::string type;
             ss >> type;
-            if (type == "MSG") {
-                MACAddress src_mac;
-                IPAddress dest_ip;
-                size_t count = 1;
-                std::string next;
-                ss >> next;
-                if (next == "REPE") {
-                    ss >> count;
-                    ss >> src_mac >> dest_ip;
-                } else {
-                    src_mac = std::stoi(next);
-                    ss >> dest_ip;
-                }
-                std::string segment;
-                std::getline(ss, segment);
-
-                bool disregard = false;
-
-                auto it = nodes.find(src_mac);
-                if (it == nodes.end())
-                    throw std::invalid_argument("Bad message file: Invalid MAC '" + std::to_string(src_mac) + "', not a MAC address of a node");
-                else if (!it->second->is_up) {
-                    log(LogLevel::WARNING, "Node (mac:" + std::to_string(src_mac) + ") is down and cannot send segments");
-                    disregard = true;
-                }
-
-                auto it2 = ip_to_mac.find(dest_ip);
-                if (it2 == ip_to_mac.end())
-                    throw std::invalid_argument("Bad message file: Invalid IP '" + std::to_string(dest_ip) + "', not an IP address of a node");
-                else if (!nodes.at(it2->second)->is_up) {
-                    log(LogLevel::WARNING, "Node (mac:" + std::to_string(it2->second) + ") is down and cannot receive segments");
-                    disregard = true;
-                }
-
-                if (src_mac == it2->second)
-                    throw std::invalid_argument("Bad message file: MSG with identical source and destination");
-
-                if (!disregard) {
-                    auto z = hop_count_with_min_distance(src_mac, it2->second);
-                    if (z.has_value()) {
-                        ideal_packets_transmitted += count * z.value().first;
-                        ideal_packets_distance += count * z.value().second;
-                    } else
-                        log(LogLevel::WARNING, "Graph is disconnected, (ip:" + std::to_string(dest_ip) + ") is unreachable from (mac:" + std::to_string(src_mac) + ")");
-                }
-
-                nr_segments_to_be_delivered += count;
-                if (count == 1) {
-                    segment_delivered[{ it2->second, segment }] = false;
-                    nodes[src_mac]->add_to_send_segment_queue(NodeWork::SegmentToSendInfo(dest_ip, std::vector<uint8_t>(segment.begin(), segment.end())));
-                } else {
-                    std::vector<NodeWork::SegmentToSendInfo> v;
-                    v.reserve(count);
-                    for (size_t i = 0; i < count; ++i) {
-                        std::string r = segment + "#" + std::to_string(i);
-                        segment_delivered[{ it2->second, r }] = false;
-                        auto s = NodeWork::SegmentToSendInfo(dest_ip, std::vector<uint8_t>(r.begin(), r.end()));
-                        v.push_back(s);
-                    }
-                    nodes[src_mac]->add_to_send_segment_queue(v);
-                }
-            } else if (type == "UP" || type == "DOWN")
+            if (type == "MSG" || type == "CBR" || type == "POISSON" || type == "BURST")
+                traffic.push_back(parse_traffic(line));
+            else if (is_topology_change(type))
                 break;
             else
                 throw std::invalid_argument("Bad message file: Unknown type line '" + type + "'");
         } while ((keep_going = (std::getline(msgfile, line) ? true : false)));
+        totals = prepare_traffic(traffic);
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+        wait_for(network_quiet());
+        /*
+         * a quiet network may only mean that the timers of a slow periodic protocol
+         * have not fired yet, so `do_periodic` always gets `delay_ms` before injection
+         */
+        std::this_thread::sleep_until(periodic_launched_at + std::chrono::milliseconds(delay_ms));
 
-        for (auto g : nodes)
-            g.second->send_segments();
+        if (topology_change_pending) {
+            topology_changed_at = Clock::now();
+            topology_change_pending = false;
+        }
+        Clock::duration injection_time = inject_segments();
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+        auto quiet = network_quiet();
+        wait_for([this, &quiet] { return (nr_segments_delivered >= nr_segments_expected && segment_packets_in_flight == 0) || quiet(); });
 
-        for (auto g : nodes)
-            g.second->end_periodic();
+        runtime->end_periodic();
+        runtime->wait_periodic_parked();
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+        /*
+         * receivers are parked one at a time, each once its queue is empty (see `end_recv`),
+         * so whatever is still in flight after `delay_ms` dies out at parked nodes
+         */
+        wait_for([this] { return packets_in_flight == 0; });
 
-        for (auto g : nodes)
-            g.second->end_recv();
+        runtime->end_recv();
+        runtime->wait_recv_parked();
 
-        std::cout << std::string(50, '=') << '\n';
+        *out << std::string(50, '=') << '\n';
 
         log(LogLevel::INFO, "Total packets transmitted = " + std::to_string(packets_transmitted));
         log(LogLevel::INFO, "Total packet distance     = " + std::to_string(packets_distance));
-        if (packets_transmitted != ideal_packets_transmitted)
-            log(LogLevel::ERROR, "Ideal packets transmitted = " + std::to_string(ideal_packets_transmitted));
-        if (packets_distance != ideal_packets_distance)
-            log(LogLevel::ERROR, "Ideal packets distance    = " + std::to_string(ideal_packets_distance));
+        log(LogLevel::INFO, "Total packet bytes        = " + std::to_string(packets_bytes));
+        log(LogLevel::INFO, "All packets transmitted   = " + std::to_string(total_packets_transmitted) + " (" + std::to_string(total_packets_bytes) + " bytes, distance " + std::to_string(total_packets_distance) + ")");
+        log(LogLevel::INFO, class_breakdown());
+        if (packets_dropped > 0)
+            log(LogLevel::WARNING, "Packets dropped at down nodes or links = " + std::to_string(packets_dropped));
+        if (packets_dropped_at_queues > 0)
+            log(LogLevel::WARNING, "Packets dropped by queue policy = " + std::to_string(packets_dropped_at_queues));
+        if (packets_dropped_unreceived > 0)
+            log(LogLevel::WARNING, "Packets dropped at nodes not receiving = " + std::to_string(packets_dropped_unreceived));
+        if (packets_refused > 0)
+            log(LogLevel::WARNING, "Packets refused by full queues = " + std::to_string(packets_refused));
+        if (profiler != nullptr)
+            log(LogLevel::INFO, profiler->report(total_packets_transmitted));
+        log(LogLevel::INFO, "Peak RSS                  = " + std::to_string(peak_rss_mib()) + " MiB");
+        PathOracle::Stats ps = oracle.take_stats();
+        if (ps.nr_computed + ps.nr_cached > 0)
+            log(LogLevel::INFO, "Shortest paths: " + std::to_string(ps.nr_computed) + " source tree(s) computed, " + std::to_string(ps.nr_cached) + " queries answered from cache");
+        if (totals.nr_multipath_segments > 0)
+            log(LogLevel::INFO, "Segments with several shortest paths = " + std::to_string(totals.nr_multipath_segments));
+        if (packets_transmitted < totals.ideal_packets_transmitted || packets_transmitted > totals.max_ideal_packets_transmitted) {
+            std::string range = std::to_string(totals.ideal_packets_transmitted);
+            if (totals.max_ideal_packets_transmitted != totals.ideal_packets_transmitted)
+                range += " to " + std::to_string(totals.max_ideal_packets_transmitted);
+            log(LogLevel::ERROR, "Ideal packets transmitted = " + range);
+        }
+        if (packets_distance != totals.ideal_packets_distance)
+            log(LogLevel::ERROR, "Ideal packets distance    = " + std::to_string(totals.ideal_packets_distance));
 
         size_t nr_segments_undelivered = 0;
         std::stringstream ss;
         ss << "Some segment(s) not delivered:\n";
-        for (auto i : segment_delivered) {
-            if (!i.second) {
+        for (auto const& i : segment_ids) {
+            if (!segments[i.second].delivered) {
                 nr_segments_undelivered++;
                 ss << "\tAt (mac:" << i.first.first << ") with contents:\n\t\t" << i.first.second << '\n';
             }
         }
         if (nr_segments_undelivered > 0)
             log(LogLevel::ERROR, ss.str());
-        segment_delivered.clear();
 
-        log(LogLevel::STATS, std::to_string(packets_transmitted) + " " + std::to_string(ideal_packets_transmitted));
-        log(LogLevel::STATS, std::to_string(packets_distance) + " " + std::to_string(ideal_packets_distance));
-        log(LogLevel::STATS, std::to_string(nr_segments_undelivered) + " " + std::to_string(nr_segments_wrongly_delivered) + " " + std::to_string(nr_segments_to_be_delivered));
+        if (injection_time > Clock::duration::zero()) {
+            size_t nr_delivered = 0;
+            for (auto const& r : segments)
+                nr_delivered += r.delivered;
+            double injection_s = std::chrono::duration<double>(injection_time).count();
+            log(LogLevel::INFO, "Injected " + std::to_string(segments.size()) + " segment(s) over " + std::to_string(injection_s * 1e3) + " ms, offered load = " + std::to_string(segments.size() / injection_s) + " segments/s");
+            log(LogLevel::INFO, "Delivered throughput      = " + std::to_string(nr_delivered / injection_s) + " segments/s");
+        }
 
-        // up/down nodes
-        do {
-            std::stringstream ss(line);
-            std::string type;
-            ss >> type;
-            bool is_up;
-            std::string log_prefix;
-            if (type == "DOWN") {
-                is_up = false;
-                log_prefix = "Bringing down (mac:";
-            } else if (type == "UP") {
-                is_up = true;
-                log_prefix = "Bringing up (mac:";
-            } else
+        Convergence c = convergence();
+        double convergence_ms = std::chrono::duration<double, std::milli>(c.time).count();
+        if (c.nr_flows == 0)
+            log(LogLevel::INFO, "Convergence time          = n/a (no reachable flows)");
+        else if (c.nr_unconverged_flows > 0)
+            log(LogLevel::ERROR, "Not converged: " + std::to_string(c.nr_unconverged_flows) + " of " + std::to_string(c.nr_flows) + " flow(s) never had a segment delivered along a shortest path");
+        else
+            log(LogLevel::INFO, "Convergence time          = " + std::to_string(convergence_ms) + " ms");
+        if (nr_routing_loops > 0)
+            log(LogLevel::WARNING, "Routing loops detected    = " + std::to_string(nr_routing_loops));
+
+        if (!segments.empty())
+            log(LogLevel::INFO, latency_report());
+        if (segment_trace_out != nullptr)
+            dump_segment_traces();
+
+        segment_ids.clear();
+        segments.clear();
+        phase++;
+
+        phase_results.push_back({ packets_transmitted, totals.ideal_packets_transmitted, packets_distance, totals.ideal_packets_distance,
+            nr_segments_undelivered, nr_segments_wrongly_delivered, totals.nr_segments_to_be_delivered,
+            c.nr_flows == 0 || c.nr_unconverged_flows > 0 ? std::nullopt : std::optional<double>(convergence_ms), nr_routing_loops });
+        log(LogLevel::STATS, std::to_string(packets_transmitted) + " " + std::to_string(totals.ideal_packets_transmitted));
+        log(LogLevel::STATS, std::to_string(packets_distance) + " " + std::to_string(totals.ideal_packets_distance));
+        log(LogLevel::STATS, std::to_string(nr_segments_undelivered) + " " + std::to_string(nr_segments_wrongly_delivered) + " " + std::to_string(totals.nr_segments_to_be_delivered));
+        log(LogLevel::STATS, std::to_string(c.nr_flows == 0 || c.nr_unconverged_flows > 0 ? -1.0 : convergence_ms) + " " + std::to_string(nr_routing_loops));
+
+        // up/down nodes, links and their distances, new nodes and links
+        bool topology_changed = false;
+        size_t nr_cached_trees = oracle.nr_cached_trees();
+        while (apply_topology_change(line)) {
+            topology_changed = true;
+            if (!(keep_going = (std::getline(msgfile, line) ? true : false)))
                 break;
-            MACAddress mac;
-            while (ss >> mac) {
-                auto it = nodes.find(mac);
-                if (it == nodes.end())
-                    throw std::invalid_argument("Bad message file: Invalid node '" + std::to_string(mac) + "', not a MAC address of a node");
-                log(LogLevel::INFO, log_prefix + std::to_string(mac) + ")");
-                it->second->is_up = is_up;
-            }
-        } while ((keep_going = (std::getline(msgfile, line) ? true : false)));
+        }
+        if (topology_changed && nr_cached_trees > 0)
+            log(LogLevel::INFO, "Shortest paths: kept " + std::to_string(oracle.nr_cached_trees()) + " of " + std::to_string(nr_cached_trees) + " cached source tree(s)");
+        if (topology_changed)
+            topology_change_pending = true;
+
+        if (snapshot_out != nullptr && (phase == snapshot_phase || (snapshot_phase == 0 && !keep_going)))
+            save_snapshot(msgfile, line, keep_going);
     }
+    if (snapshot_out != nullptr && snapshot_phase > phase)
+        log(LogLevel::WARNING, "No snapshot saved, the run ended after phase " + std::to_string(phase));
 }
@@ -1,17 +1,23 @@
 #include "node.h"
 #include "node_impl/blaster.h"
+#include "node_impl/blaster_coro.h"
 #include "node_impl/naive.h"
 #include "node_impl/rp.h"
-#include "node_work.h"
+#include "node_simulation.h"
 #include "simulation.h"
 
-#include <fstream>
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
 #include <map>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
+thread_local Simulation::CurrentTrace* Simulation::current_trace = nullptr;
+
 void Simulation::log(LogLevel l, std::string logline) const
 {
     if (grading_view && l != LogLevel::STATS)
@@ -20,8 +26,8 @@ void Simulation::log(LogLevel l, std::string logline) const
         return;
     std::lock_guard<std::mutex> lg(log_mt);
     if (grading_view) {
-        std::cout << logline << '\n'
-                  << std::flush;
+        *out << logline << '\n'
+             << std::flush;
         return;
     }
     std::string ll;
@@ -44,149 +50,309 @@ void Simulation::log(LogLevel l, std::string logline) const
     case LogLevel::STATS:
         __builtin_unreachable();
     }
-    std::cout << ll << logline << '\n'
-              << std::flush;
+    *out << ll << logline << '\n'
+         << std::flush;
 }
 
-void Node::send_packet(MACAddress dest_mac, std::vector<uint8_t> const& packet, bool contains_segment) const
+SendStatus Node::send_packet(MACAddress dest_mac, std::vector<uint8_t> const& packet, bool contains_segment, PacketClass cls) const
 {
-    simul->send_packet(this->mac, dest_mac, packet, contains_segment);
+    return simul->send_packet(this->mac, dest_mac, packet, contains_segment, cls);
 }
-void Node::broadcast_packet_to_all_neighbors(std::vector<uint8_t> const& packet, bool contains_segment) const
+void Node::broadcast_packet_to_all_neighbors(std::vector<uint8_t> const& packet, bool contains_segment, PacketClass cls) const
 {
-    simul->broadcast_packet_to_all_neighbors(this->mac, packet, contains_segment);
+    simul->broadcast_packet_to_all_neighbors(this->mac, packet, contains_segment, cls);
 }
 void Node::receive_segment(IPAddress src_ip, std::vector<uint8_t> const& segment) const
 {
     simul->verify_received_segment(src_ip, this->mac, segment);
 }
+QueueOccupancy Node::queue_occupancy(MACAddress mac) const
+{
+    return simul->queue_occupancy(mac);
+}
 void Node::log(std::string logline) const
 {
     simul->node_log(this->mac, logline);
 }
-void Simulation::send_packet(MACAddress src_mac, MACAddress dest_mac, std::vector<uint8_t> const& packet, bool contains_segment)
+void Simulation::account_packet(size_t distance, size_t bytes, bool contains_segment, PacketClass cls)
 {
-    if (nodes.count(dest_mac) == 0) {
-        log(LogLevel::ERROR, "Attempted to send to MAC address '" + std::to_string(dest_mac) + "' which is not a MAC address of any node");
-        return;
+    total_packets_transmitted++;
+    total_packets_distance += distance;
+    total_packets_bytes += bytes;
+    if (contains_segment) {
+        packets_transmitted++;
+        packets_distance += distance;
+        packets_bytes += bytes;
     }
 
-    auto const& b = adj[src_mac];
-    auto it = b.find(dest_mac);
-    if (it == b.end()) {
-        log(LogLevel::ERROR, "Attempted to send to MAC address '" + std::to_string(dest_mac) + "' which is not a MAC address of any neighbour of (mac:" + std::to_string(src_mac) + ")");
-        return;
+    ClassCounters& c = class_counters[static_cast<size_t>(cls)];
+    c.packets++;
+    c.bytes += bytes;
+    c.distance += distance;
+}
+void Simulation::reset_counters()
+{
+    packets_transmitted = 0;
+    packets_distance = 0;
+    packets_bytes = 0;
+    total_packets_transmitted = 0;
+    total_packets_distance = 0;
+    total_packets_bytes = 0;
+    packets_dropped = 0;
+    packets_dropped_at_queues = 0;
+    packets_dropped_unreceived = 0;
+    packets_refused = 0;
+    nr_segments_wrongly_delivered = 0;
+    for (auto& c : class_counters) {
+        c.packets = 0;
+        c.bytes = 0;
+        c.distance = 0;
+    }
+    if (profiler != nullptr)
+        profiler->reset();
+}
+Simulation::SegmentTracePtr Simulation::current_hop()
+{
+    if (current_trace == nullptr)
+        return nullptr;
+    CurrentTrace& c = *current_trace;
+    if (c.hop == nullptr)
+        c.hop = std::make_shared<SegmentTrace const>(SegmentTrace { c.segment_id, c.mac, c.distance, c.prev == nullptr ? nullptr : *c.prev });
+    return c.hop;
+}
+Simulation::SegmentTracePtr Simulation::sender_hop(bool contains_segment)
+{
+    return (contains_segment ? current_hop() : nullptr);
+}
+uint64_t Simulation::trace_packet(EventType type, MACAddress src_mac, MACAddress dest_mac, size_t bytes, bool contains_segment, PacketClass cls, uint64_t packet_id)
+{
+    if (tracer == nullptr)
+        return TRACE_NONE;
+    if (packet_id == TRACE_NONE)
+        packet_id = EventTracer::new_packet_id();
+    uint64_t segment_id = (contains_segment && current_trace != nullptr ? current_trace->segment_id : TRACE_NONE);
+    tracer->record(type, src_mac, dest_mac, bytes, cls, segment_id, packet_id);
+    return packet_id;
+}
+std::string Simulation::class_breakdown() const
+{
+    std::stringstream ss;
+    ss << "Traffic by packet class:";
+    for (size_t i = 0; i < NR_PACKET_CLASSES; ++i) {
+        ClassCounters const& c = class_counters[i];
+        if (c.packets == 0)
+            continue;
+        ss << "\n\t" << std::left << std::setw(16) << packet_class_name(static_cast<PacketClass>(i))
+           << " packets = " << std::setw(10) << c.packets
+           << " bytes = " << std::setw(12) << c.bytes
+           << " distance = " << c.distance;
     }
+    return ss.str();
+}
 
-    NodeWork* dest_nt = nodes.at(dest_mac);
+SendStatus Simulation::transmit(MACAddress src_mac, Topology::Edge const& e, MACAddress dest_mac, std::vector<uint8_t> const& packet, bool contains_segment, PacketClass cls)
+{
+    if (!e.up || !liveness.test(e.to)) {
+        // lost on the way, which the sender cannot tell
+        packets_dropped++;
+        trace_packet(EventType::DROP, src_mac, dest_mac, packet.size(), contains_segment, cls);
+        return SendStatus::SENT;
+    }
 
-    if (!dest_nt->is_up) {
-        log(LogLevel::ERROR, "Attempted to send to (mac:" + std::to_string(dest_mac) + ") which is down");
-        return;
+    uint64_t packet_id = trace_packet(EventType::SEND, src_mac, dest_mac, packet.size(), contains_segment, cls);
+    SegmentTracePtr trace = sender_hop(contains_segment);
+    SendStatus s = runtime->receive_packet(e.to, { src_mac, e.distance, packet, contains_segment, cls, trace, packet_id });
+    if (s != SendStatus::SENT)
+        trace_packet(EventType::DROP, src_mac, dest_mac, packet.size(), contains_segment, cls, packet_id);
+    // drops are counted by the runtime, refusals by the caller
+    if (s == SendStatus::WOULD_BLOCK)
+        return s;
+
+    account_packet(e.distance, packet.size(), contains_segment, cls);
+    // the path already led through the destination
+    if (trace != nullptr) {
+        for (SegmentTrace const* t = trace.get(); t != nullptr; t = t->prev.get()) {
+            if (t->mac == dest_mac) {
+                nr_routing_loops++;
+                break;
+            }
+        }
     }
+    return s;
+}
 
-    total_packets_transmitted++;
-    total_packets_distance += it->second;
-    if (contains_segment) {
-        packets_transmitted++;
-        packets_distance += it->second;
+SendStatus Simulation::send_packet(MACAddress src_mac, MACAddress dest_mac, std::vector<uint8_t> const& packet, bool contains_segment, PacketClass cls)
+{
+    Profiler::Scope ps(profiler, ProfileStage::SEND_PACKET);
+    if (cls == PacketClass::UNTAGGED)
+        cls = (contains_segment ? PacketClass::DATA : PacketClass::CONTROL);
+
+    auto dest = mac_to_index.find(dest_mac);
+    if (!dest.has_value()) {
+        log(LogLevel::ERROR, "Attempted to send to MAC address '" + std::to_string(dest_mac) + "' which is not a MAC address of any node");
+        return SendStatus::DROPPED;
     }
 
-    dest_nt->receive_packet(src_mac, packet, it->second);
+    Topology::Edge const* e = topology.find(node_index(src_mac), dest.value());
+    if (e == nullptr) {
+        log(LogLevel::ERROR, "Attempted to send to MAC address '" + std::to_string(dest_mac) + "' which is not a MAC address of any neighbour of (mac:" + std::to_string(src_mac) + ")");
+        return SendStatus::DROPPED;
+    }
+
+    SendStatus s = transmit(src_mac, *e, dest_mac, packet, contains_segment, cls);
+    if (s == SendStatus::WOULD_BLOCK)
+        packets_refused++;
+    return s;
 }
-void Simulation::broadcast_packet_to_all_neighbors(MACAddress src_mac, std::vector<uint8_t> const& packet, bool contains_segment)
+void Simulation::broadcast_packet_to_all_neighbors(MACAddress src_mac, std::vector<uint8_t> const& packet, bool contains_segment, PacketClass cls)
 {
-    for (auto r : adj.at(src_mac)) {
-        MACAddress dest_mac = r.first;
-
-        total_packets_transmitted++;
-        total_packets_distance += r.second;
-        if (contains_segment) {
-            packets_transmitted++;
-            packets_distance += r.second;
-        }
+    Profiler::Scope ps(profiler, ProfileStage::SEND_PACKET);
+    if (cls == PacketClass::UNTAGGED)
+        cls = (contains_segment ? PacketClass::DATA : PacketClass::CONTROL);
 
-        nodes.at(dest_mac)->receive_packet(src_mac, packet, r.second);
+    /*
+     * copies refused by full queues applying backpressure cannot be sent again
+     * (the node is not told to which neighbours), so they are dropped
+     */
+    for (Topology::Edge const& e : topology.edges(node_index(src_mac)))
+        if (transmit(src_mac, e, (*nodes)[e.to]->mac, packet, contains_segment, cls) == SendStatus::WOULD_BLOCK)
+            packets_dropped_at_queues++;
+}
+QueueOccupancy Simulation::queue_occupancy(MACAddress mac) const
+{
+    auto index = mac_to_index.find(mac);
+    if (!index.has_value()) {
+        log(LogLevel::ERROR, "Attempted to query the queue of MAC address '" + std::to_string(mac) + "' which is not a MAC address of any node");
+        return { 0, runtime->queue_limit().capacity };
     }
+    return { runtime->queue_length(index.value()), runtime->queue_limit().capacity };
+}
+void Simulation::set_queue_limit(QueueLimit limit)
+{
+    runtime->set_queue_limit(limit);
 }
 void Simulation::verify_received_segment(IPAddress src_ip, MACAddress dest_mac, std::vector<uint8_t> const& segment)
 {
     std::string segment_str(segment.begin(), segment.end());
 
-    auto it = segment_delivered.find({ dest_mac, segment_str });
-    if (it == segment_delivered.end()) {
+    auto it = segment_ids.find({ dest_mac, segment_str });
+    if (it == segment_ids.end()) {
         log(LogLevel::ERROR, "Segment from (ip:" + std::to_string(src_ip) + ") wrongly delivered to (mac:" + std::to_string(dest_mac) + ") with contents:\n\t" + segment_str);
         nr_segments_wrongly_delivered++;
     } else {
         std::string logline = "(mac:" + std::to_string(dest_mac) + ") received segment from (ip:" + std::to_string(src_ip) + ") with contents:\n\t" + segment_str;
-        if (it->second)
+
+        if (tracer != nullptr)
+            tracer->record(EventType::DELIVER, dest_mac, segments[it->second].src_mac, segment.size(), PacketClass::DATA, it->second);
+
+        std::unique_lock<std::mutex> ul(segments_mt);
+        SegmentRecord& r = segments[it->second];
+        if (r.delivered)
             logline = "{Duplicate delivery} " + logline;
-        it->second = true;
+        else
+            nr_segments_delivered++;
+        Clock::time_point now = Clock::now();
+        CurrentTrace const* t = current_trace;
+        if (t != nullptr && t->segment_id != it->second)
+            t = nullptr;
+        if (!r.delivered_at.has_value()) {
+            r.delivered_at = now;
+            if (t != nullptr) {
+                r.delivered_distance = t->distance;
+                if (segment_trace_out != nullptr) {
+                    r.delivered_path.push_back(t->mac);
+                    for (SegmentTrace const* h = (t->prev == nullptr ? nullptr : t->prev->get()); h != nullptr; h = h->prev.get())
+                        r.delivered_path.push_back(h->mac);
+                    std::reverse(r.delivered_path.begin(), r.delivered_path.end());
+                }
+            }
+        }
+        /*
+         * the copy delivered travelled along a shortest path iff it covered the minimum distance
+         */
+        if (t != nullptr && r.ideal.has_value() && t->distance == r.ideal->distance && !r.optimal_delivery_at.has_value())
+            r.optimal_delivery_at = now;
+        r.delivered = true;
+        ul.unlock();
+
         log(LogLevel::EVENT, logline);
     }
 }
 
+void Simulation::packet_enqueued(bool contains_segment)
+{
+    packets_in_flight++;
+    if (contains_segment)
+        segment_packets_in_flight++;
+}
+void Simulation::packet_dropped_at_queue(bool by_policy)
+{
+    if (by_policy)
+        packets_dropped_at_queues++;
+    else
+        packets_dropped_unreceived++;
+}
+void Simulation::packet_processed(bool contains_segment)
+{
+    if (contains_segment)
+        segment_packets_in_flight--;
+    packets_in_flight--;
+}
+
+size_t Simulation::node_index(MACAddress mac) const
+{
+    return mac_to_index.find(mac).value();
+}
+
 void Simulation::node_log(MACAddress mac, std::string logline) const
 {
-    auto p = nodes.at(mac);
-    if (node_log_enabled && !p->log(logline))
+    if (node_log_enabled && !runtime->log(node_index(mac), logline))
         log(LogLevel::WARNING, "Too many logs emitted at (mac:" + std::to_string(mac) + "), no more logs will be written");
 }
 
-Simulation::Simulation(NT node_type, bool node_log_enabled, std::string node_log_file_prefix, std::istream& net_spec, size_t delay_ms, bool grading_view)
-    : grading_view(grading_view), delay_ms(delay_ms), node_log_enabled(node_log_enabled), node_log_file_prefix(node_log_file_prefix)
-{
-    size_t nr_nodes, nr_edges;
-    net_spec >> nr_nodes;
-    for (size_t i = 0; i < nr_nodes; ++i) {
-        MACAddress mac;
-        IPAddress ip;
-        net_spec >> mac >> ip;
-        if (adj.count(mac) > 0)
-            throw std::invalid_argument(std::string("Bad network file: MAC '") + std::to_string(mac) + "' repeated");
-        if (ip_to_mac.count(ip) > 0)
-            throw std::invalid_argument(std::string("Bad network file: IP '") + std::to_string(ip) + "' repeated");
-        adj[mac] = {};
-        ip_to_mac[ip] = mac;
-    }
-    net_spec >> nr_edges;
-    for (size_t i = 0; i < nr_edges; ++i) {
-        MACAddress m1, m2;
-        size_t distance;
-        net_spec >> m1 >> m2 >> distance;
-        if (adj[m1].count(m2) > 0)
-            throw std::invalid_argument(std::string("Bad network file: Edge between (mac:'") + std::to_string(m1) + "),(mac:" + std::to_string(m2) + ") repeated");
-        adj[m1][m2] = distance;
-        adj[m2][m1] = distance;
-    }
-
-    for (auto const& i : ip_to_mac) {
-        IPAddress ip = i.first;
-        MACAddress mac = i.second;
-        Node* node = nullptr;
-
-        switch (node_type) {
-        case NT::NAIVE:
-            node = new NaiveNode(this, mac, ip);
-            break;
-        case NT::BLASTER:
-            node = new BlasterNode(this, mac, ip);
-            break;
-        case NT::RP:
-            node = new RPNode(this, mac, ip);
-            break;
-        }
+Simulation::Simulation(std::unique_ptr<NodeArena> arena, NT node_type, bool node_log_enabled, std::string node_log_file_prefix, NetSpec const& net_spec, size_t delay_ms, bool grading_view, std::ostream* segment_trace_out, EventTracer* tracer, Profiler* profiler)
+    : grading_view(grading_view), delay_ms(delay_ms), node_log_enabled(node_log_enabled), node_log_file_prefix(node_log_file_prefix),
+      nodes(std::move(arena)), liveness(0), oracle(topology, liveness), segment_trace_out(segment_trace_out), tracer(tracer), profiler(profiler), out(&std::cout),
+      nr_setup_threads(std::max<size_t>(1, std::thread::hardware_concurrency())), node_type(node_type)
+{
+    size_t nr_nodes = net_spec.nodes.size();
+    for (auto const& [mac, ip] : net_spec.nodes)
+        nodes->emplace(this, mac, ip);
+    mac_to_index = net_spec.mac_to_index;
+    ip_to_index = net_spec.ip_to_index;
+    topology = net_spec.topology;
 
-        std::ostream* log_stream = nullptr;
-        if (node_log_enabled) {
-            log_stream = new std::ofstream(node_log_file_prefix + std::to_string(mac) + ".log");
-            (*log_stream) << std::setprecision(2) << std::fixed;
-        }
-        nodes[mac] = new NodeWork(node, log_stream);
-    }
+    liveness.resize(nr_nodes);
+}
+void Simulation::start_runtime(std::unique_ptr<NodeRuntime> runtime)
+{
+    this->runtime = std::move(runtime);
+    this->runtime->add_nodes();
+}
+void Simulation::stop_runtime()
+{
+    runtime.reset();
 }
 Simulation::~Simulation()
 {
-    for (auto const& g : nodes)
-        delete g.second;
+    // the runtime still refers to the nodes
+    runtime.reset();
 }
+
+std::unique_ptr<Simulation> Simulation::create(NT node_type, bool node_log_enabled, std::string node_log_file_prefix, NetSpec const& net_spec, size_t delay_ms, bool grading_view, std::ostream* segment_trace_out, EventTracer* tracer, Profiler* profiler, size_t nr_workers)
+{
+    auto make = [&]<class NodeT>() -> std::unique_ptr<Simulation> {
+        return std::make_unique<NodeSimulation<NodeT>>(node_type, node_log_enabled, node_log_file_prefix, net_spec, delay_ms, grading_view, segment_trace_out, tracer, profiler, nr_workers);
+    };
+    switch (node_type) {
+    case NT::NAIVE:
+        return make.template operator()<NaiveNode>();
+    case NT::BLASTER:
+        return make.template operator()<BlasterNode>();
+    case NT::BLASTER_CORO:
+        return make.template operator()<BlasterCoroNode>();
+    case NT::RP:
+        return make.template operator()<RPNode>();
+    }
+    __builtin_unreachable();
+}
\ No newline at end of file
@@ -1,30 +1,219 @@
 #ifndef SIMULATION_H
 #define SIMULATION_H
 
+#include "address_index.h"
+#include "event_trace.h"
+#include "liveness.h"
+#include "net_spec.h"
 #include "node.h"
+#include "node_arena.h"
+#include "path_oracle.h"
+#include "profiler.h"
+#include "queue_limit.h"
+#include "topology.h"
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <functional>
+#include <ios>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <ostream>
 #include <optional>
 #include <string>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
-class NodeWork;
+class NodeRuntime;
+
+/*
+ * node a copy of a segment went through, linked to the hop before it, tracked by
+ * the simulator alongside (and not inside) the packets that carry it
+ */
+struct SegmentTrace {
+    size_t segment_id;
+    MACAddress mac;
+    // covered since the source
+    size_t distance;
+    // none at the source
+    std::shared_ptr<SegmentTrace const> prev;
+};
 
 struct Simulation {
+public:
+    using SegmentTrace = ::SegmentTrace;
+    using SegmentTracePtr = std::shared_ptr<SegmentTrace const>;
+    /*
+     * copy of a segment that caused the node callback running on this thread, at that node
+     * packets with `contains_segment` sent from within the callback are assumed to carry it,
+     * its hop is only allocated once the first of them is sent, and shared by all of them
+     */
+    struct CurrentTrace {
+        size_t segment_id;
+        MACAddress mac;
+        size_t distance;
+        SegmentTracePtr const* prev;
+        SegmentTracePtr hop;
+    };
+    static thread_local CurrentTrace* current_trace;
+    /*
+     * hop of `current_trace` at its node (none if there is none), for a node to keep
+     * along with a packet it only handles once the callback has returned
+     */
+    static SegmentTracePtr current_hop();
+
+    struct SegmentToSendInfo {
+        IPAddress dest_ip;
+        std::vector<uint8_t> segment;
+        size_t segment_id;
+        // offset from the start of injection
+        std::chrono::steady_clock::duration inject_at;
+        SegmentToSendInfo(IPAddress ip, std::vector<uint8_t> segment, size_t segment_id, std::chrono::steady_clock::duration inject_at)
+            : dest_ip(ip), segment(std::move(segment)), segment_id(segment_id), inject_at(inject_at) { }
+    };
+
+    struct PacketReceivedInfo {
+        MACAddress src_mac;
+        size_t dist;
+        std::vector<uint8_t> packet;
+        bool contains_segment;
+        PacketClass cls;
+        // hop of the sender, the copy having covered its distance plus `dist`
+        SegmentTracePtr trace;
+        uint64_t packet_id;
+        PacketReceivedInfo(MACAddress src_mac, size_t dist, std::vector<uint8_t> const& packet, bool contains_segment, PacketClass cls, SegmentTracePtr trace, uint64_t packet_id)
+            : src_mac(src_mac), dist(dist), packet(packet), contains_segment(contains_segment), cls(cls), trace(std::move(trace)), packet_id(packet_id) { }
+    };
+
 private:
     bool const grading_view;
     size_t const delay_ms;
     bool const node_log_enabled;
     std::string const node_log_file_prefix;
 
-    std::unordered_map<MACAddress, NodeWork*> nodes;
-    std::unordered_map<IPAddress, MACAddress> ip_to_mac;
-    std::unordered_map<MACAddress, std::unordered_map<MACAddress, size_t>> adj;
+    /*
+     * nodes are identified by a dense index, in the order of the network file
+     * (and of `ADD_NODE`s thereafter)
+     */
+    std::unique_ptr<NodeArena> nodes;
+    // which knows the type of `nodes`
+    template <class NodeT>
+    friend class NodeSimulation;
+    std::unique_ptr<NodeRuntime> runtime;
+    LivenessSet liveness;
+    AddressIndex mac_to_index;
+    AddressIndex ip_to_index;
+    Topology topology;
+    PathOracle oracle;
+    size_t node_index(MACAddress mac) const;
+    /*
+     * applies an UP/DOWN/LINK_UP/LINK_DOWN/COST/ADD_NODE/ADD_EDGE line,
+     * returns false if `line` is none of these
+     */
+    bool apply_topology_change(std::string const& line);
+
+    using Clock = std::chrono::steady_clock;
 
-    std::map<std::pair<MACAddress, std::string>, bool> segment_delivered;
+    struct SegmentRecord {
+        MACAddress src_mac;
+        MACAddress dest_mac;
+        // shortest paths, if any
+        std::optional<PathOracle::Path> ideal;
+        bool delivered;
+        std::optional<Clock::time_point> optimal_delivery_at;
+        std::optional<Clock::time_point> injected_at;
+        // of the first copy delivered
+        std::optional<Clock::time_point> delivered_at;
+        std::optional<size_t> delivered_distance;
+        // MACs it visited, only kept for `segment_trace_out`
+        std::vector<MACAddress> delivered_path;
+        SegmentRecord(MACAddress src_mac, MACAddress dest_mac, std::optional<PathOracle::Path> ideal)
+            : src_mac(src_mac), dest_mac(dest_mac), ideal(ideal), delivered(false) { }
+    };
+    // (destination, contents) -> index into `segments`
+    std::map<std::pair<MACAddress, std::string>, size_t> segment_ids;
+    std::vector<SegmentRecord> segments;
+    std::mutex segments_mt;
+
+    /*
+     * a MSG/CBR/POISSON/BURST line, validated
+     * the segments it stands for are only generated by `traffic_payloads`
+     */
+    struct TrafficSpec {
+        std::string type;
+        size_t src;
+        size_t dest;
+        IPAddress dest_ip;
+        // either end is down
+        bool disregard;
+        // MSG
+        std::string segment;
+        size_t count;
+        // CBR/POISSON/BURST
+        size_t flow;
+        double rate;
+        Clock::duration duration;
+        size_t size;
+        size_t burst_len;
+    };
+    size_t nr_flows_generated = 0;
+    TrafficSpec parse_traffic(std::string const& line);
+    // segment ids are left to be assigned
+    std::vector<SegmentToSendInfo> traffic_payloads(TrafficSpec const& t) const;
+    /*
+     * over the segments of a phase, where several shortest paths are ideal
+     * the packets transmitted range over their hop counts
+     */
+    struct TrafficTotals {
+        size_t ideal_packets_transmitted = 0;
+        size_t max_ideal_packets_transmitted = 0;
+        size_t ideal_packets_distance = 0;
+        size_t nr_segments_to_be_delivered = 0;
+        size_t nr_multipath_segments = 0;
+    };
+    /*
+     * computes the ideal paths of `traffic` (grouped by source) while generating
+     * its payloads, both in parallel on a share of the setup threads each,
+     * then records its segments in order
+     */
+    TrafficTotals prepare_traffic(std::vector<TrafficSpec> const& traffic);
+    // (source index, segment) to be injected this phase
+    std::vector<std::pair<size_t, SegmentToSendInfo>> outbound;
+    Clock::duration inject_segments();
+
+    Clock::time_point run_started_at;
+    // completed
+    std::atomic<size_t> phase = 0;
+    std::ostream* const segment_trace_out;
+    std::string latency_report() const;
+    void dump_segment_traces() const;
+
+    /*
+     * packets queued at, or being processed by, a node
+     */
+    std::atomic<size_t> packets_in_flight = 0;
+    std::atomic<size_t> segment_packets_in_flight = 0;
+    std::atomic<size_t> nr_segments_delivered = 0;
+    std::atomic<size_t> nr_segments_expected = 0;
+    bool wait_for(std::function<bool()> const& done) const;
+    std::function<bool()> network_quiet() const;
+
+    /*
+     * first injection of segments after the last topology change (or of the run): the waits
+     * of the simulator before it are not counted as convergence time
+     */
+    Clock::time_point topology_changed_at;
+    std::atomic<size_t> nr_routing_loops = 0;
+    struct Convergence {
+        size_t nr_flows;
+        size_t nr_unconverged_flows;
+        // since `topology_changed_at`, until the last flow had a segment delivered along a shortest path
+        Clock::duration time;
+    };
+    Convergence convergence() const;
 
     std::atomic<size_t> packets_transmitted = 0;
     std::atomic<size_t> packets_distance = 0;
@@ -32,6 +221,42 @@ private:
     std::atomic<size_t> total_packets_distance = 0;
     std::atomic<size_t> nr_segments_wrongly_delivered = 0;
 
+    // sent to nodes, or over links, that are down
+    std::atomic<size_t> packets_dropped = 0;
+    /*
+     * by the queue policy (including broadcast copies refused by backpressure),
+     * sent to nodes parked at the end of a phase (only once packets are still
+     * in flight after `delay_ms`), refused by full queues applying backpressure
+     */
+    std::atomic<size_t> packets_dropped_at_queues = 0;
+    std::atomic<size_t> packets_dropped_unreceived = 0;
+    std::atomic<size_t> packets_refused = 0;
+
+    std::atomic<size_t> packets_bytes = 0;
+    std::atomic<size_t> total_packets_bytes = 0;
+
+    static size_t constexpr NR_PACKET_CLASSES = static_cast<size_t>(PacketClass::ACK) + 1;
+    struct ClassCounters {
+        std::atomic<size_t> packets = 0;
+        std::atomic<size_t> bytes = 0;
+        std::atomic<size_t> distance = 0;
+    };
+    std::array<ClassCounters, NR_PACKET_CLASSES> class_counters;
+    void account_packet(size_t distance, size_t bytes, bool contains_segment, PacketClass cls);
+    void reset_counters();
+    // of `current_trace`, none unless `contains_segment`
+    SegmentTracePtr sender_hop(bool contains_segment);
+
+    EventTracer* const tracer;
+    Profiler* const profiler;
+    // with a new packet id unless given one
+    uint64_t trace_packet(EventType type, MACAddress src_mac, MACAddress dest_mac, size_t bytes, bool contains_segment, PacketClass cls, uint64_t packet_id = TRACE_NONE);
+    // over the link `e` from `src_mac` to `dest_mac`
+    SendStatus transmit(MACAddress src_mac, Topology::Edge const& e, MACAddress dest_mac, std::vector<uint8_t> const& packet, bool contains_segment, PacketClass cls);
+    std::string class_breakdown() const;
+
+    // where the simulator's logs go
+    std::ostream* out;
     mutable std::mutex log_mt;
     enum class LogLevel {
         DEBUG,
@@ -43,22 +268,163 @@ private:
     };
     void log(LogLevel l, std::string logline) const;
 
-    std::optional<std::pair<size_t, size_t>> hop_count_with_min_distance(MACAddress m1, MACAddress m2) const;
+    // threads computing ideal paths and generating payloads
+    size_t nr_setup_threads;
+    // shortest paths of each (from, to), if any, on up to `nr_threads` threads
+    std::vector<std::optional<PathOracle::Path>> ideal_paths(std::vector<std::pair<size_t, size_t>> const& queries, size_t nr_threads);
+
+public:
+    /*
+     * what is reported in the STATS lines at the end of a phase
+     */
+    struct PhaseResult {
+        size_t packets_transmitted;
+        size_t ideal_packets_transmitted;
+        size_t packets_distance;
+        size_t ideal_packets_distance;
+        size_t nr_segments_undelivered;
+        size_t nr_segments_wrongly_delivered;
+        size_t nr_segments_to_be_delivered;
+        // none if some flows never converged
+        std::optional<double> convergence_ms;
+        size_t nr_routing_loops;
+    };
+
+    /*
+     * counters of the phase being run (reset at its start) and packets in flight,
+     * read from atomics only, so that they can be sampled from any thread at any time
+     */
+    struct Metrics {
+        size_t nr_phases_completed;
+        size_t packets_transmitted;
+        size_t packets_distance;
+        size_t packets_bytes;
+        size_t total_packets_transmitted;
+        size_t total_packets_distance;
+        size_t total_packets_bytes;
+        std::array<size_t, NR_PACKET_CLASSES> class_packets;
+        std::array<size_t, NR_PACKET_CLASSES> class_bytes;
+        size_t packets_dropped;
+        size_t packets_dropped_at_queues;
+        size_t packets_dropped_unreceived;
+        size_t packets_refused;
+        // queued at, or being processed by, a node
+        size_t packets_in_flight;
+        size_t segment_packets_in_flight;
+        size_t nr_segments_delivered;
+        size_t nr_segments_expected;
+        size_t nr_routing_loops;
+    };
+    Metrics metrics() const;
+
+private:
+    std::vector<PhaseResult> phase_results;
 
 public:
     enum class NT {
         NAIVE,
         BLASTER,
+        BLASTER_CORO,
         RP,
     };
-    Simulation(NT node_type, bool log_enabled, std::string logfile_prefix, std::istream& net_spec, size_t delay_ms, bool grading_view);
+
+private:
+    NT const node_type;
+    /*
+     * snapshots are taken at a phase boundary, once its topology changes have been
+     * applied, when every queue has been drained and all that is left is the network,
+     * the protocol state of the nodes and where the message file is at
+     */
+    std::ostream* snapshot_out = nullptr;
+    size_t snapshot_phase = 0;
+    // offset into the message file after, and contents of, the line to resume from
+    std::optional<std::pair<std::streamoff, std::string>> resume_at;
+    void save_snapshot(std::istream& msg_file, std::string const& line, bool keep_going);
+
+protected:
+    // `arena` is empty, and made of the node type of `node_type`
+    Simulation(std::unique_ptr<NodeArena> arena, NT node_type, bool log_enabled, std::string logfile_prefix, NetSpec const& net_spec, size_t delay_ms, bool grading_view, std::ostream* segment_trace_out, EventTracer* tracer, Profiler* profiler);
+    /*
+     * for derived classes to call in their constructor, and first thing in their
+     * destructor, as the runtime calls back into them
+     */
+    void start_runtime(std::unique_ptr<NodeRuntime> runtime);
+    void stop_runtime();
+
+    template <class Callback>
+    void traced_send_segment(MACAddress mac, SegmentToSendInfo const& f, Callback const& callback)
+    {
+        CurrentTrace origin { f.segment_id, mac, 0, nullptr, nullptr };
+        current_trace = &origin;
+        callback();
+        current_trace = nullptr;
+    }
+    template <class Callback>
+    void traced_receive_callback(MACAddress mac, PacketReceivedInfo const& f, Callback const& callback)
+    {
+        if (tracer != nullptr)
+            tracer->record(EventType::RECEIVE, mac, f.src_mac, f.packet.size(), f.cls, f.trace == nullptr ? TRACE_NONE : f.trace->segment_id, f.packet_id);
+        std::optional<CurrentTrace> at;
+        if (f.trace != nullptr)
+            at.emplace(CurrentTrace { f.trace->segment_id, mac, f.trace->distance + f.dist, &f.trace, nullptr });
+        current_trace = (at.has_value() ? &at.value() : nullptr);
+        {
+            Profiler::Scope ps(profiler, ProfileStage::RECEIVE_CALLBACK);
+            callback();
+        }
+        current_trace = nullptr;
+    }
+    template <class Callback>
+    void traced_periodic_callback(MACAddress mac, Callback const& callback)
+    {
+        if (tracer != nullptr && tracer->record_timers)
+            tracer->record(EventType::TIMER, mac);
+        Profiler::Scope ps(profiler, ProfileStage::PERIODIC_CALLBACK);
+        callback();
+    }
+
+public:
+    /*
+     * a `NodeSimulation` of the node type of `node_type`
+     * `nr_workers` is 0 for a receive and a periodic thread per node,
+     * otherwise nodes are run in compact mode by that many worker threads
+     */
+    static std::unique_ptr<Simulation> create(NT node_type, bool log_enabled, std::string logfile_prefix, NetSpec const& net_spec, size_t delay_ms, bool grading_view, std::ostream* segment_trace_out = nullptr, EventTracer* tracer = nullptr, Profiler* profiler = nullptr, size_t nr_workers = 0);
     void run(std::istream& msg_file);
-    ~Simulation();
+    virtual ~Simulation();
+
+    // std::cout unless set otherwise
+    void set_output(std::ostream* out) { this->out = out; }
+    // unbounded unless set otherwise, to be called before `run`
+    void set_queue_limit(QueueLimit limit);
+    // one per CPU unless set otherwise, to be called before `run`
+    void set_setup_threads(size_t n) { nr_setup_threads = std::max<size_t>(n, 1); }
+    // of every phase run so far
+    std::vector<PhaseResult> const& results() const { return phase_results; }
 
-    void send_packet(MACAddress src_mac, MACAddress dest_mac, std::vector<uint8_t> const& packet, bool from_do_periodic);
-    void broadcast_packet_to_all_neighbors(MACAddress src_mac, std::vector<uint8_t> const& packet, bool from_do_periodic);
+    /*
+     * saves a snapshot to `out` after `phase` phases (counting those of the run
+     * restored from, if any), or after the last one if 0
+     */
+    void save_snapshot_after(size_t phase, std::ostream* out);
+    /*
+     * to be called before `run`, on a simulation of the same node type and network
+     * file as the one the snapshot was taken from
+     * `run` then resumes the message file where the snapshot left it, or reads it
+     * from the start if the snapshot was taken at its end
+     */
+    void restore(std::istream& snapshot);
+
+    SendStatus send_packet(MACAddress src_mac, MACAddress dest_mac, std::vector<uint8_t> const& packet, bool contains_segment, PacketClass cls);
+    QueueOccupancy queue_occupancy(MACAddress mac) const;
+    void broadcast_packet_to_all_neighbors(MACAddress src_mac, std::vector<uint8_t> const& packet, bool contains_segment, PacketClass cls);
     void verify_received_segment(IPAddress src_ip, MACAddress dest_mac, std::vector<uint8_t> const& segment);
     void node_log(MACAddress, std::string logline) const;
+
+    void packet_enqueued(bool contains_segment);
+    // by the node's queue policy, or as the node is not receiving
+    void packet_dropped_at_queue(bool by_policy);
+    void packet_processed(bool contains_segment);
 };
 
 #endif // SIMULATION_H
@@ -0,0 +1,188 @@
+#include "snapshot.h"
+#include "node_runtime.h"
+#include "simulation.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+SnapshotWriter::SnapshotWriter(std::ostream& out)
+    : out(out)
+{
+    SnapshotFileHeader h;
+    std::copy(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC), h.magic);
+    h.version = SNAPSHOT_VERSION;
+    out.write(reinterpret_cast<char const*>(&h), sizeof(h));
+}
+
+void SnapshotWriter::u64(uint64_t v)
+{
+    do {
+        uint8_t b = v & 0x7f;
+        v >>= 7;
+        out.put(static_cast<char>(b | (v != 0 ? 0x80 : 0)));
+    } while (v != 0);
+}
+
+void SnapshotWriter::bytes(std::vector<uint8_t> const& b)
+{
+    u64(b.size());
+    out.write(reinterpret_cast<char const*>(b.data()), b.size());
+}
+
+void SnapshotWriter::str(std::string const& s)
+{
+    u64(s.size());
+    out.write(s.data(), s.size());
+}
+
+static std::invalid_argument truncated()
+{
+    return std::invalid_argument("Bad snapshot: Truncated");
+}
+
+SnapshotReader::SnapshotReader(std::istream& in)
+    : in(in)
+{
+    SnapshotFileHeader h;
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)) || !std::equal(std::begin(SNAPSHOT_MAGIC), std::end(SNAPSHOT_MAGIC), h.magic))
+        throw std::invalid_argument("Bad snapshot: Not a snapshot");
+    if (h.version != SNAPSHOT_VERSION)
+        throw std::invalid_argument("Bad snapshot: Unsupported version " + std::to_string(h.version));
+}
+
+uint64_t SnapshotReader::u64()
+{
+    uint64_t v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int c = in.get();
+        if (c == std::char_traits<char>::eof())
+            throw truncated();
+        v |= uint64_t(c & 0x7f) << shift;
+        if ((c & 0x80) == 0)
+            return v;
+    }
+    throw std::invalid_argument("Bad snapshot: Malformed integer");
+}
+
+std::vector<uint8_t> SnapshotReader::bytes()
+{
+    std::vector<uint8_t> b(u64());
+    if (!in.read(reinterpret_cast<char*>(b.data()), b.size()))
+        throw truncated();
+    return b;
+}
+
+std::string SnapshotReader::str()
+{
+    std::string s(u64(), '\0');
+    if (!in.read(s.data(), s.size()))
+        throw truncated();
+    return s;
+}
+
+void Simulation::save_snapshot_after(size_t phase, std::ostream* out)
+{
+    snapshot_phase = phase;
+    snapshot_out = out;
+}
+
+void Simulation::save_snapshot(std::istream& msg_file, std::string const& line, bool keep_going)
+{
+    SnapshotWriter w(*snapshot_out);
+    w.u64(static_cast<uint64_t>(node_type));
+    w.u64(phase);
+    w.u64(nr_flows_generated);
+    w.u64(keep_going);
+    if (keep_going) {
+        w.u64(msg_file.tellg());
+        w.str(line);
+    }
+
+    size_t nr_nodes = nodes->size();
+    w.u64(nr_nodes);
+    for (size_t i = 0; i < nr_nodes; ++i) {
+        w.u64((*nodes)[i]->mac);
+        w.u64((*nodes)[i]->ip);
+        w.u64(liveness.test(i));
+    }
+    // every link once, from its end with the lower index
+    size_t nr_links = 0;
+    for (size_t i = 0; i < nr_nodes; ++i)
+        nr_links += std::count_if(topology.edges(i).begin(), topology.edges(i).end(), [i](Topology::Edge const& e) { return e.to >= i; });
+    w.u64(nr_links);
+    for (size_t i = 0; i < nr_nodes; ++i)
+        for (Topology::Edge const& e : topology.edges(i))
+            if (e.to >= i) {
+                w.u64(i);
+                w.u64(e.to);
+                w.u64(e.distance);
+                w.u64(e.up);
+            }
+    for (size_t i = 0; i < nr_nodes; ++i)
+        w.bytes((*nodes)[i]->serialize());
+
+    snapshot_out->flush();
+    if (!*snapshot_out)
+        throw std::runtime_error("Unable to write snapshot");
+    log(LogLevel::INFO, "Saved snapshot after phase " + std::to_string(phase) + " (" + std::to_string(nr_nodes) + " node(s), " + std::to_string(nr_links) + " link(s))");
+}
+
+void Simulation::restore(std::istream& snapshot)
+{
+    SnapshotReader r(snapshot);
+    if (r.u64() != static_cast<uint64_t>(node_type))
+        throw std::invalid_argument("Bad snapshot: Taken with another node type");
+    phase = r.u64();
+    nr_flows_generated = r.u64();
+    if (r.u64() != 0) {
+        std::streamoff offset = r.u64();
+        resume_at.emplace(offset, r.str());
+    }
+
+    /*
+     * nodes of the network file are already there, those added since are added back
+     */
+    size_t nr_nodes = r.u64();
+    size_t nr_initial_nodes = nodes->size();
+    if (nr_nodes < nr_initial_nodes || nr_nodes > AddressIndex::MAX_INDEX)
+        throw std::invalid_argument("Bad snapshot: Taken with another network file");
+    std::vector<bool> up(nr_nodes);
+    for (size_t i = 0; i < nr_nodes; ++i) {
+        MACAddress mac = r.u64();
+        IPAddress ip = r.u64();
+        up[i] = r.u64();
+        if (i < nr_initial_nodes) {
+            if ((*nodes)[i]->mac != mac || (*nodes)[i]->ip != ip)
+                throw std::invalid_argument("Bad snapshot: Taken with another network file");
+            continue;
+        }
+        if (!mac_to_index.insert(mac, i) || !ip_to_index.insert(ip, i))
+            throw std::invalid_argument("Bad snapshot: Node (mac:" + std::to_string(mac) + ") repeated");
+        nodes->emplace(this, mac, ip);
+    }
+
+    size_t nr_links = r.u64();
+    std::vector<Topology::Link> links;
+    std::vector<std::pair<size_t, size_t>> down_links;
+    for (size_t i = 0; i < nr_links; ++i) {
+        size_t a = r.u64(), b = r.u64(), distance = r.u64();
+        if (a >= nr_nodes || b >= nr_nodes || distance > Topology::MAX_DISTANCE)
+            throw std::invalid_argument("Bad snapshot: Malformed link");
+        links.emplace_back(a, b, distance);
+        if (r.u64() == 0)
+            down_links.emplace_back(a, b);
+    }
+    if (topology.build(nr_nodes, links).has_value())
+        throw std::invalid_argument("Bad snapshot: Link repeated");
+    for (auto const& [a, b] : down_links)
+        topology.set_up(a, b, false);
+
+    liveness.resize(nr_nodes);
+    for (size_t i = 0; i < nr_nodes; ++i)
+        liveness.set(i, up[i]);
+    runtime->add_nodes();
+
+    for (size_t i = 0; i < nr_nodes; ++i)
+        (*nodes)[i]->deserialize(r.bytes());
+    log(LogLevel::INFO, "Restored snapshot after phase " + std::to_string(phase) + " (" + std::to_string(nr_nodes) + " node(s), " + std::to_string(nr_links) + " link(s))");
+}
@@ -0,0 +1,49 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * binary snapshot format: a `SnapshotFileHeader` followed by fields encoded as
+ * LEB128 varints, strings and byte arrays being prefixed by their length
+ */
+static char constexpr SNAPSHOT_MAGIC[8] = { 'L', '2', 'S', 'S', 'N', 'A', 'P', '\0' };
+static uint32_t constexpr SNAPSHOT_VERSION = 1;
+
+struct SnapshotFileHeader {
+    char magic[8];
+    uint32_t version;
+};
+
+class SnapshotWriter {
+private:
+    std::ostream& out;
+
+public:
+    explicit SnapshotWriter(std::ostream& out);
+
+    void u64(uint64_t v);
+    void bytes(std::vector<uint8_t> const& b);
+    void str(std::string const& s);
+};
+
+/*
+ * throws `std::invalid_argument` on a truncated or otherwise bad snapshot
+ */
+class SnapshotReader {
+private:
+    std::istream& in;
+
+public:
+    explicit SnapshotReader(std::istream& in);
+
+    uint64_t u64();
+    std::vector<uint8_t> bytes();
+    std::string str();
+};
+
+#endif // SNAPSHOT_H
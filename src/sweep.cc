@@ -0,0 +1,175 @@
+#include "sweep.h"
+#include "parallel.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+
+std::vector<SweepRun> parse_manifest(std::istream& manifest, std::map<std::string, Simulation::NT> const& node_types)
+{
+    std::vector<SweepRun> runs;
+    std::string line;
+    while (std::getline(manifest, line)) {
+        std::stringstream ss(line);
+        SweepRun r;
+        if (!(ss >> r.node_type_name) || r.node_type_name[0] == '#')
+            continue;
+        auto nt = node_types.find(r.node_type_name);
+        if (nt == node_types.end())
+            throw std::invalid_argument("Bad manifest: Unknown node type '" + r.node_type_name + "'");
+        r.node_type = nt->second;
+        if (!(ss >> r.net_spec_file >> r.msg_file))
+            throw std::invalid_argument("Bad manifest: Malformed line '" + line + "'");
+        std::string param;
+        while (ss >> param) {
+            auto malformed = [&param]() { return std::invalid_argument("Bad manifest: Malformed parameter '" + param + "'"); };
+            size_t eq = param.find('=');
+            if (eq == std::string::npos)
+                throw malformed();
+            std::string key = param.substr(0, eq);
+            size_t value;
+            try {
+                value = std::stoul(param.substr(eq + 1));
+            } catch (std::exception const&) {
+                throw malformed();
+            }
+            if (key == "delay")
+                r.delay_ms = value;
+            else if (key == "workers") {
+                if (value == 0)
+                    throw malformed();
+                r.nr_workers = value;
+            } else
+                throw std::invalid_argument("Bad manifest: Unknown parameter '" + param + "'");
+        }
+        runs.push_back(r);
+    }
+    return runs;
+}
+
+static std::string json_string(std::string const& s)
+{
+    std::stringstream ss;
+    ss << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            ss << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec;
+        else
+            ss << c;
+    }
+    ss << '"';
+    return ss.str();
+}
+
+void run_sweep(std::vector<SweepRun> const& runs, size_t nr_jobs, std::ostream& report)
+{
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point started_at = Clock::now();
+
+    /*
+     * network and message files shared by several runs are only parsed (read) once
+     */
+    struct Input {
+        std::optional<NetSpec> net_spec;
+        std::string contents;
+        std::string error;
+    };
+    std::map<std::string, Input> net_specs, msg_files;
+    for (auto const& r : runs) {
+        net_specs[r.net_spec_file];
+        msg_files[r.msg_file];
+    }
+    std::vector<std::pair<std::string const*, Input*>> inputs;
+    for (auto& [path, in] : net_specs)
+        inputs.emplace_back(&path, &in);
+    size_t nr_net_specs = inputs.size();
+    for (auto& [path, in] : msg_files)
+        inputs.emplace_back(&path, &in);
+    parallel_for(inputs.size(), nr_jobs, [&](size_t i) {
+        auto& [path, in] = inputs[i];
+        std::ifstream f(*path);
+        if (!f.is_open()) {
+            in->error = "Unable to open file '" + *path + "' for reading";
+            return;
+        }
+        if (i >= nr_net_specs) {
+            std::stringstream ss;
+            ss << f.rdbuf();
+            in->contents = ss.str();
+            return;
+        }
+        try {
+            in->net_spec = NetSpec::parse(f);
+        } catch (std::exception const& e) {
+            in->error = e.what();
+        }
+    });
+
+    struct Outcome {
+        std::vector<Simulation::PhaseResult> results;
+        std::string error;
+        double wall_ms;
+    };
+    std::vector<Outcome> outcomes(runs.size());
+    parallel_for(runs.size(), nr_jobs, [&](size_t i) {
+        SweepRun const& r = runs[i];
+        Outcome& o = outcomes[i];
+        Input const& net_spec = net_specs.at(r.net_spec_file);
+        Input const& msgs = msg_files.at(r.msg_file);
+        Clock::time_point run_started_at = Clock::now();
+        if (!net_spec.error.empty())
+            o.error = net_spec.error;
+        else if (!msgs.error.empty())
+            o.error = msgs.error;
+        else {
+            // the output of a run (its STATS only) is not kept, its results are
+            std::ostringstream out;
+            try {
+                auto s = Simulation::create(r.node_type, false, "", net_spec.net_spec.value(), r.delay_ms, true, nullptr, nullptr, nullptr, r.nr_workers);
+                s->set_output(&out);
+                // each run keeps to its worker budget, setup included
+                s->set_setup_threads(r.nr_workers);
+                std::istringstream msg_file(msgs.contents);
+                s->run(msg_file);
+                o.results = s->results();
+            } catch (std::exception const& e) {
+                o.error = e.what();
+            }
+        }
+        o.wall_ms = std::chrono::duration<double, std::milli>(Clock::now() - run_started_at).count();
+    });
+
+    report << "{\n  \"wall_ms\": " << std::chrono::duration<double, std::milli>(Clock::now() - started_at).count() << ",\n  \"runs\": [";
+    for (size_t i = 0; i < runs.size(); ++i) {
+        SweepRun const& r = runs[i];
+        Outcome const& o = outcomes[i];
+        report << (i == 0 ? "\n" : ",\n")
+               << "    {\"node_type\": " << json_string(r.node_type_name) << ", \"netspec\": " << json_string(r.net_spec_file) << ", \"msgs\": " << json_string(r.msg_file)
+               << ", \"delay_ms\": " << r.delay_ms << ", \"workers\": " << r.nr_workers << ", \"wall_ms\": " << o.wall_ms;
+        if (!o.error.empty()) {
+            report << ", \"error\": " << json_string(o.error) << "}";
+            continue;
+        }
+        report << ", \"phases\": [";
+        for (size_t p = 0; p < o.results.size(); ++p) {
+            Simulation::PhaseResult const& pr = o.results[p];
+            report << (p == 0 ? "\n" : ",\n")
+                   << "      {\"packets_transmitted\": " << pr.packets_transmitted << ", \"ideal_packets_transmitted\": " << pr.ideal_packets_transmitted
+                   << ", \"packets_distance\": " << pr.packets_distance << ", \"ideal_packets_distance\": " << pr.ideal_packets_distance
+                   << ", \"segments_undelivered\": " << pr.nr_segments_undelivered << ", \"segments_wrongly_delivered\": " << pr.nr_segments_wrongly_delivered
+                   << ", \"segments_to_be_delivered\": " << pr.nr_segments_to_be_delivered << ", \"convergence_ms\": ";
+            if (pr.convergence_ms.has_value())
+                report << pr.convergence_ms.value();
+            else
+                report << "null";
+            report << ", \"routing_loops\": " << pr.nr_routing_loops << "}";
+        }
+        report << (o.results.empty() ? "]}" : "\n    ]}");
+    }
+    report << (runs.empty() ? "]\n}\n" : "\n  ]\n}\n");
+}
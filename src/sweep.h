@@ -0,0 +1,39 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "simulation.h"
+
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * a line of a sweep manifest, "NODE_TYPE FILE.netspec FILE.msgs [delay=MS] [workers=N]",
+ * blank lines and lines starting with '#' being skipped
+ */
+struct SweepRun {
+    std::string node_type_name;
+    Simulation::NT node_type;
+    std::string net_spec_file;
+    std::string msg_file;
+    size_t delay_ms = 50;
+    /*
+     * runs are always in compact mode, by default with a single worker,
+     * and use no more setup threads than workers
+     */
+    size_t nr_workers = 1;
+};
+
+// throws `std::invalid_argument` on a bad manifest
+std::vector<SweepRun> parse_manifest(std::istream& manifest, std::map<std::string, Simulation::NT> const& node_types);
+
+/*
+ * runs `runs` on `nr_jobs` threads, each in its own `Simulation`, every network
+ * (and message) file being parsed (read) once for all the runs using it,
+ * and writes the STATS of every phase of every run to `report` as JSON
+ */
+void run_sweep(std::vector<SweepRun> const& runs, size_t nr_jobs, std::ostream& report);
+
+#endif // SWEEP_H
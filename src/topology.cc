@@ -0,0 +1,81 @@
+#include "topology.h"
+
+#include <algorithm>
+
+static auto constexpr by_index = [](Topology::Edge const& e, size_t to) { return e.to < to; };
+
+Topology::Edge const* Topology::find(size_t from, size_t to) const
+{
+    auto const& edges = adj[from];
+    auto it = std::lower_bound(edges.begin(), edges.end(), to, by_index);
+    return (it == edges.end() || it->to != to ? nullptr : &*it);
+}
+Topology::Edge* Topology::find_mutable(size_t from, size_t to)
+{
+    return const_cast<Edge*>(find(from, to));
+}
+
+std::optional<std::pair<size_t, size_t>> Topology::build(size_t nr_nodes, std::vector<Link> const& links)
+{
+    std::vector<uint32_t> degrees(nr_nodes, 0);
+    for (auto const& [a, b, distance] : links) {
+        degrees[a]++;
+        degrees[b] += (a != b);
+    }
+    adj.assign(nr_nodes, {});
+    for (size_t i = 0; i < nr_nodes; ++i)
+        adj[i].reserve(degrees[i]);
+    for (auto const& [a, b, distance] : links) {
+        adj[a].emplace_back(b, distance);
+        if (a != b)
+            adj[b].emplace_back(a, distance);
+    }
+    for (size_t i = 0; i < nr_nodes; ++i) {
+        auto& edges = adj[i];
+        std::sort(edges.begin(), edges.end(), [](Edge const& x, Edge const& y) { return x.to < y.to; });
+        for (size_t j = 1; j < edges.size(); ++j)
+            if (edges[j].to == edges[j - 1].to)
+                return std::pair<size_t, size_t> { i, edges[j].to };
+    }
+    return std::nullopt;
+}
+
+size_t Topology::add_node()
+{
+    adj.emplace_back();
+    return adj.size() - 1;
+}
+
+bool Topology::add_link(size_t a, size_t b, uint32_t distance)
+{
+    if (find(a, b) != nullptr)
+        return false;
+    auto insert = [this, distance](size_t from, size_t to) {
+        auto& edges = adj[from];
+        edges.insert(std::lower_bound(edges.begin(), edges.end(), to, by_index), Edge(to, distance));
+    };
+    insert(a, b);
+    if (a != b)
+        insert(b, a);
+    return true;
+}
+
+bool Topology::set_up(size_t a, size_t b, bool up)
+{
+    Edge* e1 = find_mutable(a, b);
+    if (e1 == nullptr)
+        return false;
+    e1->up = up;
+    find_mutable(b, a)->up = up;
+    return true;
+}
+
+bool Topology::set_distance(size_t a, size_t b, uint32_t distance)
+{
+    Edge* e1 = find_mutable(a, b);
+    if (e1 == nullptr)
+        return false;
+    e1->distance = distance;
+    find_mutable(b, a)->distance = distance;
+    return true;
+}
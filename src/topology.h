@@ -0,0 +1,54 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <cstdint>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+/*
+ * adjacency of the network over node indices
+ * `edges(i)` lists the links of node i sorted by the index of the other end;
+ * links that are down are kept, along with their distance, until they come back up
+ * mutations may not race with anything else
+ */
+class Topology {
+public:
+    static size_t constexpr MAX_DISTANCE = (size_t(1) << 31) - 1;
+    struct Edge {
+        uint32_t to;
+        uint32_t distance : 31;
+        uint32_t up : 1;
+        Edge(uint32_t to, uint32_t distance)
+            : to(to), distance(distance), up(1) { }
+    };
+    // (a, b, distance)
+    using Link = std::tuple<uint32_t, uint32_t, uint32_t>;
+
+private:
+    std::vector<std::vector<Edge>> adj;
+    Edge* find_mutable(size_t from, size_t to);
+
+public:
+    size_t size() const { return adj.size(); }
+    std::vector<Edge> const& edges(size_t i) const { return adj[i]; }
+    Edge const* find(size_t from, size_t to) const;
+
+    /*
+     * replaces the adjacency, allocating every list once at its exact size
+     * returns a repeated link if any (and leaves the adjacency incomplete)
+     */
+    std::optional<std::pair<size_t, size_t>> build(size_t nr_nodes, std::vector<Link> const& links);
+
+    size_t add_node();
+    /*
+     * all return false (and leave the adjacency as is) if the link already exists,
+     * or does not exist, respectively
+     */
+    bool add_link(size_t a, size_t b, uint32_t distance);
+    bool set_up(size_t a, size_t b, bool up);
+    bool set_distance(size_t a, size_t b, uint32_t distance);
+};
+
+#endif // TOPOLOGY_H
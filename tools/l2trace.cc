@@ -0,0 +1,267 @@
+#include "../src/event_trace.h"
+
+#include <algorithm>
+#include <argp.h>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+/*
+ * inspection tool for traces recorded with `bin/main ... --trace FILE`
+ */
+
+static char const* doc = "l2trace - Inspect a layer2simulator event trace\n"
+                         "Prints the (filtered) events in time order, unless --stats or --chrome is given";
+static char const* args_doc = "FILE.trace";
+static struct argp_option options[] = {
+    { "node", 'n', "MAC", 0, "Only events at, or to, node MAC" },
+    { "packet", 'p', "ID", 0, "Only events of packet ID" },
+    { "segment", 's', "ID", 0, "Only events of segment ID" },
+    { "phase", 'P', "N", 0, "Only events of phase N" },
+    { "type", 'T', "TYPE", 0, "Only events of TYPE (send, receive, drop, up, down, timer, deliver, phase, link-up, link-down, cost, add-node, add-edge)" },
+    { "stats", 'S', NULL, 0, "Print statistics instead of events" },
+    { "chrome", 'c', "OUT.json", 0, "Convert to Chrome trace/Perfetto JSON" },
+    { 0 }
+};
+
+struct Args {
+    char const* file = nullptr;
+    std::optional<MACAddress> node;
+    std::optional<uint64_t> packet;
+    std::optional<uint64_t> segment;
+    std::optional<uint32_t> phase;
+    std::optional<std::string> type;
+    bool stats = false;
+    char const* chrome = nullptr;
+};
+
+static error_t parse_opt(int key, char* arg, struct argp_state* state)
+{
+    Args* a = static_cast<Args*>(state->input);
+    switch (key) {
+    case 'n':
+        a->node = std::stoul(arg);
+        break;
+    case 'p':
+        a->packet = std::stoull(arg);
+        break;
+    case 's':
+        a->segment = std::stoull(arg);
+        break;
+    case 'P':
+        a->phase = std::stoul(arg);
+        break;
+    case 'T':
+        a->type = arg;
+        break;
+    case 'S':
+        a->stats = true;
+        break;
+    case 'c':
+        a->chrome = arg;
+        break;
+    case ARGP_KEY_ARG:
+        if (state->arg_num >= 1)
+            argp_usage(state);
+        a->file = arg;
+        break;
+    case ARGP_KEY_END:
+        if (state->arg_num < 1)
+            argp_usage(state);
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static bool matches(Args const& a, TraceEvent const& e)
+{
+    if (a.node.has_value() && e.node != a.node.value()
+        && !((e.type == EventType::SEND || e.type == EventType::DROP || e.type >= EventType::LINK_UP) && e.peer == a.node.value()))
+        return false;
+    if (a.packet.has_value() && e.packet_id != a.packet.value())
+        return false;
+    if (a.segment.has_value() && e.segment_id != a.segment.value())
+        return false;
+    if (a.phase.has_value() && e.phase != a.phase.value())
+        return false;
+    if (a.type.has_value() && a.type.value() != event_type_name(e.type))
+        return false;
+    return true;
+}
+
+static std::string id_str(uint64_t id)
+{
+    return (id == TRACE_NONE ? "-" : std::to_string(id));
+}
+
+static void print_events(std::vector<TraceEvent> const& events)
+{
+    std::cout << std::fixed << std::setprecision(3);
+    for (auto const& e : events) {
+        std::cout << std::setw(14) << e.time_ns / 1e3 << "us  phase " << e.phase << "  "
+                  << std::left << std::setw(8) << event_type_name(e.type) << std::right
+                  << " node " << e.node;
+        switch (e.type) {
+        case EventType::SEND:
+        case EventType::DROP:
+            std::cout << " -> " << e.peer;
+            break;
+        case EventType::RECEIVE:
+            std::cout << " <- " << e.peer;
+            break;
+        case EventType::DELIVER:
+            std::cout << " from " << e.peer;
+            break;
+        case EventType::LINK_UP:
+        case EventType::LINK_DOWN:
+        case EventType::COST:
+        case EventType::ADD_EDGE:
+            std::cout << " -- " << e.peer << " distance " << e.bytes;
+            break;
+        default:
+            break;
+        }
+        if (e.type == EventType::SEND || e.type == EventType::RECEIVE || e.type == EventType::DROP)
+            std::cout << "  " << packet_class_name(e.cls) << " " << e.bytes << "B packet " << id_str(e.packet_id);
+        if (e.segment_id != TRACE_NONE)
+            std::cout << " segment " << e.segment_id;
+        std::cout << '\n';
+    }
+}
+
+static void print_stats(std::vector<TraceEvent> const& events)
+{
+    if (events.empty()) {
+        std::cout << "No events\n";
+        return;
+    }
+    double span_s = (events.back().time_ns - events.front().time_ns) / 1e9;
+
+    std::map<std::string, size_t> by_type;
+    std::map<std::string, std::pair<size_t, size_t>> sends_by_class;
+    std::map<MACAddress, size_t> sends_by_node;
+    std::unordered_set<uint64_t> sent, received;
+    for (auto const& e : events) {
+        by_type[event_type_name(e.type)]++;
+        if (e.type == EventType::SEND) {
+            auto& c = sends_by_class[packet_class_name(e.cls)];
+            c.first++;
+            c.second += e.bytes;
+            sends_by_node[e.node]++;
+            sent.insert(e.packet_id);
+        } else if (e.type == EventType::RECEIVE)
+            received.insert(e.packet_id);
+    }
+    size_t nr_unreceived = 0;
+    for (uint64_t id : sent)
+        nr_unreceived += (received.count(id) == 0);
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Events: " << events.size() << " over " << span_s * 1e3 << " ms";
+    if (span_s > 0)
+        std::cout << " (" << events.size() / span_s << " events/s)";
+    std::cout << "\n\nBy type:\n";
+    for (auto const& i : by_type)
+        std::cout << '\t' << std::left << std::setw(16) << i.first << std::right << i.second << '\n';
+    std::cout << "\nSends by packet class:\n";
+    for (auto const& i : sends_by_class)
+        std::cout << '\t' << std::left << std::setw(16) << i.first << std::right << i.second.first << " packets, " << i.second.second << " bytes\n";
+    std::cout << "\nSent but never received: " << nr_unreceived << '\n';
+
+    std::vector<std::pair<size_t, MACAddress>> top;
+    for (auto const& i : sends_by_node)
+        top.emplace_back(i.second, i.first);
+    std::sort(top.rbegin(), top.rend());
+    std::cout << "\nBusiest senders:\n";
+    for (size_t i = 0; i < top.size() && i < 10; ++i)
+        std::cout << "\t(mac:" << top[i].second << ") " << top[i].first << " packets\n";
+}
+
+static void write_chrome(std::vector<TraceEvent> const& events, std::ostream& out)
+{
+    /*
+     * every node is a thread of a single process, packets are flow events from their SEND to their RECEIVE
+     */
+    std::unordered_set<MACAddress> nodes;
+    out << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto begin = [&]() -> std::ostream& {
+        if (!first)
+            out << ",\n";
+        first = false;
+        return out;
+    };
+    for (auto const& e : events) {
+        double ts = e.time_ns / 1e3;
+        if (e.type == EventType::PHASE) {
+            begin() << "{\"name\":\"phase " << e.phase << "\",\"ph\":\"i\",\"s\":\"g\",\"ts\":" << ts << ",\"pid\":1,\"tid\":0}";
+            continue;
+        }
+        nodes.insert(e.node);
+        begin() << "{\"name\":\"" << event_type_name(e.type) << "\",\"cat\":\"" << packet_class_name(e.cls)
+                << "\",\"ph\":\"i\",\"s\":\"t\",\"ts\":" << ts << ",\"pid\":1,\"tid\":" << e.node
+                << ",\"args\":{\"peer\":" << e.peer << ",\"bytes\":" << e.bytes << ",\"phase\":" << e.phase;
+        if (e.packet_id != TRACE_NONE)
+            out << ",\"packet\":" << e.packet_id;
+        if (e.segment_id != TRACE_NONE)
+            out << ",\"segment\":" << e.segment_id;
+        out << "}}";
+        if (e.packet_id != TRACE_NONE && (e.type == EventType::SEND || e.type == EventType::RECEIVE))
+            begin() << "{\"name\":\"packet\",\"cat\":\"" << packet_class_name(e.cls) << "\",\"ph\":\""
+                    << (e.type == EventType::SEND ? "s" : "f\",\"bp\":\"e") << "\",\"id\":" << e.packet_id
+                    << ",\"ts\":" << ts << ",\"pid\":1,\"tid\":" << e.node << "}";
+    }
+    for (MACAddress m : nodes)
+        begin() << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << m << ",\"args\":{\"name\":\"node " << m << "\"}}";
+    out << "\n]}\n";
+}
+
+int main(int ac, char** av)
+{
+    Args a;
+    struct argp ap = { options, parse_opt, args_doc, doc };
+    argp_parse(&ap, ac, av, 0, 0, &a);
+
+    std::ifstream in(a.file, std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "Unable to open file '" << a.file << "' for reading\n";
+        return 1;
+    }
+    TraceFileHeader h;
+    if (!in.read(reinterpret_cast<char*>(&h), sizeof(h)) || std::memcmp(h.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        std::cerr << "'" << a.file << "' is not a layer2simulator trace\n";
+        return 1;
+    }
+    if (h.version != TRACE_VERSION || h.event_size != sizeof(TraceEvent)) {
+        std::cerr << "Unsupported trace version " << h.version << '\n';
+        return 1;
+    }
+
+    std::vector<TraceEvent> events;
+    TraceEvent e;
+    while (in.read(reinterpret_cast<char*>(&e), sizeof(e)))
+        if (matches(a, e))
+            events.push_back(e);
+    std::stable_sort(events.begin(), events.end(), [](TraceEvent const& x, TraceEvent const& y) { return x.time_ns < y.time_ns; });
+
+    if (a.chrome != nullptr) {
+        std::ofstream out(a.chrome);
+        if (!out.is_open()) {
+            std::cerr << "Unable to open file '" << a.chrome << "' for writing\n";
+            return 1;
+        }
+        write_chrome(events, out);
+    }
+    if (a.stats)
+        print_stats(events);
+    else if (a.chrome == nullptr)
+        print_events(events);
+}